@@ -0,0 +1,179 @@
+#include "endgame.h"
+#include "tables.h"
+
+#include <stdlib.h>
+
+#define FILE_A 0x0101010101010101ULL
+#define FILE_H 0x8080808080808080ULL
+
+// Classification during generation. Invalid positions (touching kings, a
+// piece on the pawn, black in check with white to move) are 0 so they drop
+// out when the results of all moves are ORed together.
+enum { KPK_INVALID = 0, KPK_UNKNOWN = 1, KPK_DRAW = 2, KPK_WIN = 4 };
+
+static uint32_t kpk_bits[KPK_SIZE / 32];
+static bool kpk_ready = false;
+
+// Pawn squares a2-d7 map to 0-23.
+static inline int kpk_index(int strong_king, int pawn, int weak_king,
+                            bool strong_to_move) {
+    return strong_to_move | weak_king << 1 | strong_king << 7 |
+           ((pawn / 8 - 1) * 4 + pawn % 8) << 13;
+}
+
+static inline int distance(int a, int b) {
+    int files = abs(a % 8 - b % 8);
+    int ranks = abs(a / 8 - b / 8);
+    return files > ranks ? files : ranks;
+}
+
+static inline uint64_t pawn_attacks(int pawn) {
+    uint64_t bb = 1ULL << pawn;
+    return ((bb & ~FILE_A) << 7) | ((bb & ~FILE_H) << 9);
+}
+
+// The result of positions decided without looking further: illegal ones, a
+// promotion the black king can't stop and black stalemated or taking the
+// pawn.
+static uint8_t kpk_initial(int index) {
+    bool white = index & 1;
+    int weak_king = index >> 1 & 63;
+    int strong_king = index >> 7 & 63;
+    int pawn = ((index >> 13) / 4 + 1) * 8 + (index >> 13) % 4;
+    uint64_t attacks = pawn_attacks(pawn);
+
+    if (distance(strong_king, weak_king) <= 1 || strong_king == pawn ||
+        weak_king == pawn || (white && (attacks & 1ULL << weak_king)))
+        return KPK_INVALID;
+
+    int promotion = pawn + 8;
+    if (white && pawn / 8 == 6 && strong_king != promotion &&
+        (distance(weak_king, promotion) > 1 ||
+         distance(strong_king, promotion) == 1))
+        return KPK_WIN;
+
+    if (!white) {
+        uint64_t escapes = king_moves[weak_king] & ~king_moves[strong_king];
+        if (!(escapes & ~attacks) || (escapes & 1ULL << pawn))
+            return KPK_DRAW;
+    }
+
+    return KPK_UNKNOWN;
+}
+
+// Combine the results of every move: white needs one winning move, black one
+// drawing move. Pawn moves to the last rank were covered by kpk_initial().
+static uint8_t kpk_classify(const uint8_t *db, int index) {
+    bool white = index & 1;
+    int weak_king = index >> 1 & 63;
+    int strong_king = index >> 7 & 63;
+    int pawn = ((index >> 13) / 4 + 1) * 8 + (index >> 13) % 4;
+    int result = KPK_INVALID;
+
+    if (white) {
+        FOREACH_SET_BIT(king_moves[strong_king], to) {
+            result |= db[kpk_index(to, pawn, weak_king, false)];
+        }
+
+        int push = pawn + 8;
+        if (pawn / 8 < 6 && push != weak_king && push != strong_king) {
+            result |= db[kpk_index(strong_king, push, weak_king, false)];
+            if (pawn / 8 == 1 && push + 8 != weak_king &&
+                push + 8 != strong_king)
+                result |=
+                    db[kpk_index(strong_king, push + 8, weak_king, false)];
+        }
+
+        return result & KPK_WIN       ? KPK_WIN
+               : result & KPK_UNKNOWN ? KPK_UNKNOWN
+                                      : KPK_DRAW;
+    }
+
+    FOREACH_SET_BIT(king_moves[weak_king], to) {
+        result |= db[kpk_index(strong_king, pawn, to, true)];
+    }
+
+    return result & KPK_DRAW      ? KPK_DRAW
+           : result & KPK_UNKNOWN ? KPK_UNKNOWN
+                                  : KPK_WIN;
+}
+
+void init_endgames() {
+    if (__atomic_load_n(&kpk_ready, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint8_t *db = malloc(KPK_SIZE);
+    if (!db) {
+        return;
+    }
+
+    for (int i = 0; i < KPK_SIZE; i++)
+        db[i] = kpk_initial(i);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < KPK_SIZE; i++) {
+            if (db[i] != KPK_UNKNOWN)
+                continue;
+            db[i] = kpk_classify(db, i);
+            changed |= db[i] != KPK_UNKNOWN;
+        }
+    }
+
+    for (int i = 0; i < KPK_SIZE; i++) {
+        if (db[i] == KPK_WIN)
+            kpk_bits[i / 32] |= 1U << (i % 32);
+    }
+
+    free(db);
+    __atomic_store_n(&kpk_ready, true, __ATOMIC_RELEASE);
+}
+
+bool kpk_probe(int strong_king, int pawn, int weak_king, bool strong_to_move) {
+    // The bitbase only covers pawns on the queenside
+    if (pawn % 8 >= 4) {
+        strong_king ^= 7;
+        pawn ^= 7;
+        weak_king ^= 7;
+    }
+
+    int index = kpk_index(strong_king, pawn, weak_king, strong_to_move);
+    return kpk_bits[index / 32] & (1U << (index % 32));
+}
+
+bool is_known_draw(Position *p) {
+    uint64_t occupied = GET_OCCUPIED(p);
+    if (__builtin_popcountll(occupied) > 3) {
+        return false;
+    }
+
+    uint64_t kings = p->bitboards[PIECE_WHITE | PIECE_KING] |
+                     p->bitboards[PIECE_BLACK | PIECE_KING];
+    uint64_t minors = p->bitboards[PIECE_WHITE | PIECE_KNIGHT] |
+                      p->bitboards[PIECE_BLACK | PIECE_KNIGHT] |
+                      p->bitboards[PIECE_WHITE | PIECE_BISHOP] |
+                      p->bitboards[PIECE_BLACK | PIECE_BISHOP];
+    uint64_t others = occupied & ~kings;
+    if (others == 0 || others == minors) {
+        return true;
+    }
+
+    int strong = p->bitboards[PIECE_WHITE | PIECE_PAWN] ? PIECE_WHITE
+                 : p->bitboards[PIECE_BLACK | PIECE_PAWN] ? PIECE_BLACK
+                                                           : -1;
+    if (strong < 0 || !__atomic_load_n(&kpk_ready, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    // Look black's pawn up as white's by flipping the board
+    int flip = strong == PIECE_WHITE ? 0 : 56;
+    int strong_king =
+        __builtin_ctzll(p->bitboards[strong | PIECE_KING]) ^ flip;
+    int weak_king =
+        __builtin_ctzll(p->bitboards[(strong ^ 8) | PIECE_KING]) ^ flip;
+    int pawn = __builtin_ctzll(p->bitboards[strong | PIECE_PAWN]) ^ flip;
+    int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+    return !kpk_probe(strong_king, pawn, weak_king, side_to_move == strong);
+}
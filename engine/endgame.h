@@ -0,0 +1,34 @@
+#ifndef ENDGAME_H
+#define ENDGAME_H
+#include "position.h"
+#include <stdbool.h>
+
+/**
+ * Exact knowledge of endgames the search can't resolve by itself before the
+ * horizon: material that can't mate (KvK, KNvK, KBvK) and king and pawn
+ * versus king, looked up in a bitbase.
+ *
+ * The KPK bitbase holds one bit (win or not) per position with white as the
+ * strong side and the pawn on files a-d, indexed by the pawn, both kings and
+ * the side to move: 24 * 64 * 64 * 2 bits, 24 KiB. init_endgames() computes it
+ * by retrograde analysis, starting from the positions decided in one move and
+ * propagating the results back until nothing changes.
+ */
+#define KPK_SIZE (24 * 64 * 64 * 2)
+
+// Build the KPK bitbase, only the first call does any work. It takes tens of
+// milliseconds, so front ends call it at startup; the search calls it too in
+// case they didn't. Until then kpk_probe() reports no wins and
+// is_known_draw() only knows the material draws.
+void init_endgames();
+
+/**
+ * Whether white, with a king on strong_king and a pawn on pawn, beats the
+ * black king on weak_king. strong_to_move is whether it's white's move.
+ */
+bool kpk_probe(int strong_king, int pawn, int weak_king, bool strong_to_move);
+
+// Whether pos is a draw with best play by the material alone, or a KPK
+// position the bitbase says can't be won.
+bool is_known_draw(Position *pos);
+#endif // ENDGAME_H
@@ -3,9 +3,14 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include "endgame.h"
 #include "eval.h"
+#include "evalcache.h"
+#include "mate.h"
+#include "nnue.h"
 #include "position.h"
 #include "search.h"
+#include "tt.h"
 #include "zobrist.h"
 #ifdef __cplusplus
 }
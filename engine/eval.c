@@ -1,8 +1,20 @@
 #include "eval.h"
+#include "tables.h"
 
+#include <stddef.h>
+
+// The king can't be traded, so it has no material value
 const int piece_values[6] = {
     [PIECE_PAWN] = 100, [PIECE_KNIGHT] = 280, [PIECE_BISHOP] = 320,
-    [PIECE_ROOK] = 479, [PIECE_QUEEN] = 929,  [PIECE_KING] = 60000};
+    [PIECE_ROOK] = 479, [PIECE_QUEEN] = 929,  [PIECE_KING] = 0};
+
+const int eg_piece_values[6] = {
+    [PIECE_PAWN] = 94,  [PIECE_KNIGHT] = 281, [PIECE_BISHOP] = 297,
+    [PIECE_ROOK] = 512, [PIECE_QUEEN] = 936,  [PIECE_KING] = 0};
+
+const int phase_weights[6] = {
+    [PIECE_PAWN] = 0, [PIECE_KNIGHT] = 1, [PIECE_BISHOP] = 1,
+    [PIECE_ROOK] = 2, [PIECE_QUEEN] = 4,  [PIECE_KING] = 0};
 
 const int piece_tables[6][64] = {
     // pawn
@@ -46,40 +58,264 @@ const int piece_tables[6][64] = {
      -55, -31, 37,  28,  -67, 44,  -57, 12,  -62, 3,   10,  55,  56,
      56,  55,  10,  -32, -62, 83,  60,  -99, -99, 47,  54,  4}};
 
-int eval_position(Position *p) {
-    int eval = 0;
+// Endgame tables: pawns gain value as they advance and the king belongs in
+// the center.
+const int eg_piece_tables[6][64] = {
+    // pawn
+    {   0,    0,    0,    0,    0,    0,    0,    0,
+       13,    8,    8,   10,   13,    0,    2,   -7,
+        4,    7,   -6,    1,    0,   -5,   -1,   -8,
+       13,    9,   -3,   -7,   -7,   -8,    3,   -1,
+       32,   24,   13,    5,   -2,    4,   17,   17,
+       94,  100,   85,   67,   56,   53,   82,   84,
+      178,  173,  158,  134,  147,  132,  165,  187,
+        0,    0,    0,    0,    0,    0,    0,    0},
+
+    // knight
+    { -29,  -51,  -23,  -15,  -22,  -18,  -50,  -64,
+      -42,  -20,  -10,   -5,   -2,  -20,  -23,  -44,
+      -23,   -3,   -1,   15,   10,   -3,  -20,  -22,
+      -18,   -6,   16,   25,   16,   17,    4,  -18,
+      -17,    3,   22,   22,   22,   11,    8,  -18,
+      -24,  -20,   10,    9,   -1,   -9,  -19,  -41,
+      -25,   -8,  -25,   -2,   -9,  -25,  -24,  -52,
+      -58,  -38,  -13,  -28,  -31,  -27,  -63,  -99},
+
+    // bishop
+    { -23,   -9,  -23,   -5,   -9,  -16,   -5,  -17,
+      -14,  -18,   -7,   -1,    4,   -9,  -15,  -27,
+      -12,   -3,    8,   10,   13,    3,   -7,  -15,
+       -6,    3,   13,   19,    7,   10,   -3,   -9,
+       -3,    9,   12,    9,   14,   10,    3,    2,
+        2,   -8,    0,   -1,   -2,    6,    0,    4,
+       -8,   -4,    7,  -12,   -3,  -13,   -4,  -14,
+      -14,  -21,  -11,   -8,   -7,   -9,  -17,  -24},
+
+    // rook
+    {  -9,    2,    3,   -1,   -5,  -13,    4,  -20,
+       -6,   -6,    0,    2,   -9,   -9,  -11,   -3,
+       -4,    0,   -5,   -1,   -7,  -12,   -8,  -16,
+        3,    5,    8,    4,   -5,   -6,   -8,  -11,
+        4,    3,   13,    1,    2,    1,   -1,    2,
+        7,    7,    7,    5,    4,   -3,   -5,   -3,
+       11,   13,   13,   11,   -3,    3,    8,    3,
+       13,   10,   18,   15,   12,   12,    8,    5},
+
+    // queen
+    { -33,  -28,  -22,  -43,   -5,  -32,  -20,  -41,
+      -22,  -23,  -30,  -16,  -16,  -23,  -36,  -32,
+      -16,  -27,   15,    6,    9,   17,   10,    5,
+      -18,   28,   19,   47,   31,   34,   39,   23,
+        3,   22,   24,   45,   57,   40,   57,   36,
+      -20,    6,    9,   49,   47,   35,   19,    9,
+      -17,   20,   32,   41,   58,   25,   30,    0,
+       -9,   22,   22,   27,   27,   19,   10,   20},
+
+    // king
+    { -53,  -34,  -21,  -11,  -28,  -14,  -24,  -43,
+      -27,  -11,    4,   13,   14,    4,   -5,  -17,
+      -19,   -3,   11,   21,   23,   16,    7,   -9,
+      -18,   -4,   21,   24,   27,   23,    9,  -11,
+       -8,   22,   24,   27,   26,   33,   26,    3,
+       10,   17,   23,   15,   20,   45,   44,   13,
+      -12,   17,   14,   17,   17,   38,   23,   11,
+      -74,  -35,  -18,  -18,  -11,   15,    4,  -17}};
+
+Score position_psq(Position *p) {
+    Score psq = 0;
+    for (int piece = 0; piece < MAX_PIECE; piece++) {
+        if (PIECE_TYPE(piece) > PIECE_KING)
+            continue;
+        FOREACH_SET_BIT(p->bitboards[piece], sq) {
+            psq += psq_value(piece, sq);
+        }
+    }
+
+    return psq;
+}
+
+int position_phase(Position *p) {
+    int phase = 0;
+    for (int piece = PIECE_KNIGHT; piece <= PIECE_QUEEN; piece++) {
+        phase += phase_weights[piece] *
+                 __builtin_popcountll(p->bitboards[piece | PIECE_WHITE] |
+                                      p->bitboards[piece | PIECE_BLACK]);
+    }
+
+    return phase;
+}
+
+// Mobility: the bonus per square a piece attacks outside of its own pieces and
+// the enemy pawns' attacks, counted from a typical number of squares.
+static const Score mobility_weight[6] = {
+    [PIECE_KNIGHT] = S(4, 4), [PIECE_BISHOP] = S(5, 5),
+    [PIECE_ROOK] = S(2, 4), [PIECE_QUEEN] = S(1, 2)};
+static const int mobility_center[6] = {
+    [PIECE_KNIGHT] = 4, [PIECE_BISHOP] = 6, [PIECE_ROOK] = 7,
+    [PIECE_QUEEN] = 14};
+
+// King safety: each attacked square around the king adds the attacker's
+// weight, and the penalty grows with the square of the total once at least
+// two pieces take part.
+static const int king_attack_weight[6] = {
+    [PIECE_KNIGHT] = 2, [PIECE_BISHOP] = 2, [PIECE_ROOK] = 3,
+    [PIECE_QUEEN] = 5};
+#define KING_DANGER_MAX 500
+
+/**
+ * Mobility and king attacks of color's pieces. Their attack sets are computed
+ * here once and also collected in attacked, so the caller can detect check
+ * without generating them again.
+ */
+static Score piece_activity(Position *p, const PawnEntry *pawns, int color,
+                            uint64_t *attacked) {
+    int us = color == PIECE_WHITE ? 0 : 1;
+    int enemy_king =
+        __builtin_ctzll(p->bitboards[(color ^ 8) | PIECE_KING]);
+    uint64_t king_zone = king_moves[enemy_king] | 1ULL << enemy_king;
+    uint64_t occupied = GET_OCCUPIED(p);
+    uint64_t area = ~GET_COLOR_OCCUPIED(p, color) & ~pawns->attacks[!us];
+
+    Score score = 0;
+    int attackers = 0, weight = 0;
+    *attacked = pawns->attacks[us] |
+                king_moves[__builtin_ctzll(p->bitboards[color | PIECE_KING])];
+    for (int type = PIECE_KNIGHT; type <= PIECE_QUEEN; type++) {
+        FOREACH_SET_BIT(p->bitboards[color | type], sq) {
+            uint64_t attacks =
+                type == PIECE_KNIGHT   ? knight_moves[sq]
+                : type == PIECE_BISHOP ? get_bishop_attacks(occupied, sq)
+                : type == PIECE_ROOK   ? get_rook_attacks(occupied, sq)
+                                       : get_bishop_attacks(occupied, sq) |
+                                           get_rook_attacks(occupied, sq);
+            *attacked |= attacks;
+            score += mobility_weight[type] *
+                     (__builtin_popcountll(attacks & area) -
+                      mobility_center[type]);
+            if (attacks & king_zone) {
+                attackers++;
+                weight += king_attack_weight[type] *
+                          __builtin_popcountll(attacks & king_zone);
+            }
+        }
+    }
+
+    if (attackers >= 2) {
+        int danger = weight * weight / 4;
+        score += S(danger < KING_DANGER_MAX ? danger : KING_DANGER_MAX, 0);
+    }
+
+    return score;
+}
+
+// Pawn structure and king shelter from white's view, with the pawn entry
+// left in pawn_entry for the piece terms.
+static Score pawn_score(Position *p, PawnTable *pawns, PawnEntry *pawn_entry) {
+    probe_pawns(pawns, p, pawn_entry);
+    return pawn_entry->score + pawn_shield(p, PIECE_WHITE) -
+           pawn_shield(p, PIECE_BLACK);
+}
+
+Score eval_positional(Position *p) {
+    PawnEntry pawn_entry;
+    uint64_t attacked[2];
+    return pawn_score(p, NULL, &pawn_entry) +
+           piece_activity(p, &pawn_entry, PIECE_WHITE, &attacked[0]) -
+           piece_activity(p, &pawn_entry, PIECE_BLACK, &attacked[1]);
+}
 
+// Whether the king of color, attacked by the opponent on the given squares,
+// has a square to step to. The sets were computed with the king on the board,
+// so sliders are looked through it for the squares behind it.
+static bool has_king_escape(Position *p, int color, uint64_t attacked) {
+    int opp = color ^ 8;
+    uint64_t king_bb = p->bitboards[color | PIECE_KING];
+    uint64_t occupied = GET_OCCUPIED(p) ^ king_bb;
+    uint64_t diagonal =
+        p->bitboards[opp | PIECE_BISHOP] | p->bitboards[opp | PIECE_QUEEN];
+    uint64_t straight =
+        p->bitboards[opp | PIECE_ROOK] | p->bitboards[opp | PIECE_QUEEN];
+    uint64_t escapes = king_moves[__builtin_ctzll(king_bb)] &
+                       ~GET_COLOR_OCCUPIED(p, color) & ~attacked;
+    FOREACH_SET_BIT(escapes, sq) {
+        if (!(get_bishop_attacks(occupied, sq) & diagonal) &&
+            !(get_rook_attacks(occupied, sq) & straight))
+            return true;
+    }
+
+    return false;
+}
+
+// Returns true and sets score if the side to move, attacked by the opponent
+// on the given squares, is checkmated. Moves are only generated when the
+// king has nowhere to step to.
+static bool is_checkmate(Position *p, uint64_t attacked, int *score) {
     int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
-    if (generate_attacks(p, side_to_move ^ 8) &
-        p->bitboards[PIECE_KING | side_to_move]) {
+    if ((attacked & p->bitboards[PIECE_KING | side_to_move]) &&
+        !has_king_escape(p, side_to_move, attacked)) {
         Move moves[256];
         if (generate_moves(p, moves) == 0) {
-            if (side_to_move == PIECE_WHITE) {
-                return -INF + 1;
-            } else {
-                return INF - 1;
-            }
+            *score = side_to_move == PIECE_WHITE ? -INF + 1 : INF - 1;
+            return true;
         }
     }
 
-    const int colors[2] = {PIECE_WHITE, PIECE_BLACK};
-    for (int piece = PIECE_PAWN; piece <= PIECE_KING; piece++) {
-        eval += piece_values[piece] *
-                __builtin_popcountll(p->bitboards[piece | PIECE_WHITE]);
-
-        eval += -1 * piece_values[piece] *
-                __builtin_popcountll(p->bitboards[piece | PIECE_BLACK]);
-
-        for (int c = 0; c < 2; c++) {
-            int color = colors[c];
-            int sign = color == PIECE_WHITE ? 1 : -1;
-            FOREACH_SET_BIT(p->bitboards[color | piece], sq) {
-                int value = color == PIECE_WHITE ? piece_tables[piece][sq]
-                                                 : piece_tables[piece][sq ^ 56];
-                eval += value * sign;
-            }
-        }
+    return false;
+}
+
+static int taper(Position *p, Score score) {
+    // Promotions can push the phase past the starting material
+    int phase = p->phase < PHASE_MAX ? p->phase : PHASE_MAX;
+    return (mg_value(score) * phase + eg_value(score) * (PHASE_MAX - phase)) /
+           PHASE_MAX;
+}
+
+int eval_position(Position *p) { return eval_position_ex(p, NULL); }
+
+int eval_position_ex(Position *p, PawnTable *pawns) {
+    return eval_position_lazy(p, pawns, -INF, INF, NULL);
+}
+
+int eval_position_lazy(Position *p, PawnTable *pawns, int alpha, int beta,
+                       bool *lazy) {
+    PawnEntry pawn_entry;
+    Score score = p->psq + pawn_score(p, pawns, &pawn_entry);
+    if (lazy)
+        *lazy = false;
+
+    // A side to move that isn't in check can't be mated, so the cheap part
+    // is exact apart from the piece terms.
+    int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+    int eval = taper(p, score);
+    if ((eval + LAZY_MARGIN <= alpha || eval - LAZY_MARGIN >= beta) &&
+        !king_attacked(p, side_to_move)) {
+        if (lazy)
+            *lazy = true;
+        return eval;
+    }
+
+    uint64_t attacked[2];
+    score += piece_activity(p, &pawn_entry, PIECE_WHITE, &attacked[0]) -
+             piece_activity(p, &pawn_entry, PIECE_BLACK, &attacked[1]);
+
+    int mate_score;
+    if (is_checkmate(p, attacked[side_to_move == PIECE_WHITE], &mate_score)) {
+        return mate_score;
+    }
+
+    return taper(p, score);
+}
+
+int eval_position_nnue(Position *p, const Accumulator *acc) {
+    int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+    int mate_score;
+    if (is_checkmate(p, generate_attacks(p, side_to_move ^ 8), &mate_score)) {
+        return mate_score;
     }
 
-    return eval;
-}
\ No newline at end of file
+    // Keep the network's output well away from mate scores
+    int eval = nnue_evaluate(acc, p);
+    return eval < -NNUE_MAX_EVAL  ? -NNUE_MAX_EVAL
+           : eval > NNUE_MAX_EVAL ? NNUE_MAX_EVAL
+                                  : eval;
+}
@@ -4,9 +4,83 @@
 
 #ifndef EVAL_H
 #define EVAL_H
+#include "nnue.h"
+#include "pawns.h"
 #include "position.h"
-#define INF 10000000
+#define INF 32000 // scores must fit the 16-bit TT field
+
+/**
+ * A Score packs a middlegame value in the low 16 bits and an endgame value in
+ * the high 16 bits, so both are accumulated with a single add. The endgame
+ * half is stored with the middlegame half's sign borrowed from it, which
+ * eg_value() corrects for by rounding.
+ */
+#define S(mg, eg) ((Score)((uint32_t)(eg) << 16) + (mg))
+
+static inline int mg_value(Score s) { return (int16_t)(uint16_t)(uint32_t)s; }
+
+static inline int eg_value(Score s) {
+    return (int16_t)(uint16_t)((uint32_t)(s + 0x8000) >> 16);
+}
+
+// Middlegame values, also used for move ordering.
 extern const int piece_tables[6][64];
 extern const int piece_values[6];
+extern const int eg_piece_tables[6][64];
+extern const int eg_piece_values[6];
+
+// Game phase: the sum of phase_weights over the pieces on the board, from
+// PHASE_MAX at the start down to 0 with only kings and pawns left. The
+// evaluation interpolates between the middlegame and endgame values by it.
+#define PHASE_MAX 24
+extern const int phase_weights[6];
+
+// Material plus piece-square value of a piece on sq, positive for white.
+static inline Score psq_value(int piece, int sq) {
+    int type = PIECE_TYPE(piece);
+    if (PIECE_COLOR(piece) == PIECE_WHITE)
+        return S(piece_values[type] + piece_tables[type][sq],
+                 eg_piece_values[type] + eg_piece_tables[type][sq]);
+    return -S(piece_values[type] + piece_tables[type][sq ^ 56],
+              eg_piece_values[type] + eg_piece_tables[type][sq ^ 56]);
+}
+
+// Sum of psq_value() over the board, execute_move() keeps it incrementally.
+Score position_psq(Position *pos);
+// The game phase from scratch, execute_move() keeps it incrementally.
+int position_phase(Position *pos);
 int eval_position(Position *pos);
+
+// The evaluation minus the material and piece-square score (i.e. pawn
+// structure, mobility and king safety), untapered. Used by the tuner.
+Score eval_positional(Position *pos);
+
+/**
+ * eval_position() with the pawn structure looked up in pawns, which should
+ * belong to the calling thread. eval_position() passes NULL and computes it
+ * every time.
+ */
+int eval_position_ex(Position *pos, PawnTable *pawns);
+
+// How far mobility and king safety, the expensive part of the evaluation,
+// can plausibly move the score. Only extreme king attacks exceed it.
+#define LAZY_MARGIN 350
+
+/**
+ * eval_position_ex() for a search that only needs to know how the score
+ * compares to the window (alpha, beta), from white's view. If material, piece
+ * squares and pawns alone put it at least LAZY_MARGIN outside the window, that
+ * estimate is returned without the remaining terms and *lazy (if not NULL) is
+ * set.
+ */
+int eval_position_lazy(Position *pos, PawnTable *pawns, int alpha, int beta,
+                       bool *lazy);
+
+#define NNUE_MAX_EVAL (INF / 2)
+
+/**
+ * eval_position() using the loaded network (see nnue_load()) instead of the
+ * handcrafted terms; acc must hold the accumulator of pos.
+ */
+int eval_position_nnue(Position *pos, const Accumulator *acc);
 #endif // EVAL_H
@@ -0,0 +1,91 @@
+#include "evalcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SCORE_MASK 0xFFFFULL
+// Spreads the 16 score bits over the key bits
+#define SCORE_SPREAD 0x9E3779B97F4A7C15ULL
+
+static uint64_t *entries = NULL;
+static uint64_t num_entries = 0;
+// Whether the size was chosen, so init_eval_cache() keeps a disabled cache
+static bool sized = false;
+
+static inline uint64_t pack(uint64_t hash, int score) {
+    uint64_t data = (uint16_t)score;
+    return ((hash ^ data * SCORE_SPREAD) & ~SCORE_MASK) | data;
+}
+
+bool resize_eval_cache(size_t mb) {
+    free_eval_cache();
+    sized = true;
+    if (mb == 0) {
+        return true;
+    }
+
+    uint64_t count = (uint64_t)mb * 1024 * 1024 / sizeof(uint64_t);
+    if (count > SIZE_MAX / sizeof(uint64_t)) {
+        return false; // overflow on 32-bit targets
+    }
+
+    entries = calloc(count, sizeof(uint64_t));
+    if (!entries) {
+        return false;
+    }
+
+    num_entries = count;
+    return true;
+}
+
+bool init_eval_cache() {
+    if (sized) {
+        return true;
+    }
+
+    return resize_eval_cache(EVAL_CACHE_DEFAULT_MB);
+}
+
+void free_eval_cache() {
+    free(entries);
+    entries = NULL;
+    num_entries = 0;
+    sized = false;
+}
+
+void clear_eval_cache() {
+    if (entries) {
+        memset(entries, 0, num_entries * sizeof(uint64_t));
+    }
+}
+
+// Same multiply-shift indexing as the transposition table
+static inline uint64_t *get_slot(uint64_t hash) {
+    return &entries[((hash & 0xFFFFFFFF) * num_entries) >> 32];
+}
+
+void eval_cache_prefetch(uint64_t hash) {
+    if (entries) {
+        __builtin_prefetch(get_slot(hash));
+    }
+}
+
+bool eval_cache_probe(uint64_t hash, int *score) {
+    if (!entries) {
+        return false;
+    }
+
+    uint64_t word = __atomic_load_n(get_slot(hash), __ATOMIC_RELAXED);
+    if (word != pack(hash, (int16_t)(word & SCORE_MASK))) {
+        return false;
+    }
+
+    *score = (int16_t)(word & SCORE_MASK);
+    return true;
+}
+
+void eval_cache_store(uint64_t hash, int score) {
+    if (entries) {
+        __atomic_store_n(get_slot(hash), pack(hash, score), __ATOMIC_RELAXED);
+    }
+}
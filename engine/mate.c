@@ -0,0 +1,345 @@
+#include "mate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Proof and disproof numbers saturate here; a node with a proof number of
+// PN_INF can't be proven, one with a disproof number of PN_INF is proven.
+#define PN_INF 100000000U
+#define BUCKET_SIZE 4
+// Mixes the remaining plies into the Zobrist key
+#define PLY_SPREAD 0x9E3779B97F4A7C15ULL
+#define TIME_CHECK_INTERVAL 1024
+
+typedef struct {
+    uint64_t key;
+    uint32_t pn;
+    uint32_t dn;
+    // Nodes searched below the entry, the cost of replacing it
+    uint32_t work;
+    // The mating move once the attacker's node is proven
+    Move move;
+} MateEntry;
+
+typedef struct {
+    MateEntry entries[BUCKET_SIZE];
+} MateBucket;
+
+static MateBucket *buckets = NULL;
+static uint64_t num_buckets = 0;
+
+// The move lists of mid(), kept off the stack since UCI runs the solver on a
+// thread whose stack can be small. Every call on the stack has a different
+// number of plies remaining, so that picks its frame.
+typedef struct {
+    Move moves[256];
+    uint64_t keys[256];
+    uint32_t pn[256];
+    uint32_t dn[256];
+} MateFrame;
+
+static MateFrame *frames = NULL;
+
+// Limits of the running search_mate(), only touched by its thread except for
+// stop_flag.
+static int stop_flag = 0;
+static uint64_t nodes = 0;
+static bool limit_nodes = false;
+static uint64_t node_limit = 0;
+static double deadline = 0;
+static uint64_t next_time_check = 0;
+
+bool resize_mate_table(size_t mb) {
+    free_mate_table();
+    uint64_t count = (uint64_t)mb * 1024 * 1024 / sizeof(MateBucket);
+    if (count == 0 || count > SIZE_MAX / sizeof(MateBucket) ||
+        count > 0xFFFFFFFFULL) {
+        return false;
+    }
+
+    buckets = calloc(count, sizeof(MateBucket));
+    if (!buckets) {
+        return false;
+    }
+
+    num_buckets = count;
+    return true;
+}
+
+void free_mate_table() {
+    free(buckets);
+    free(frames);
+    buckets = NULL;
+    frames = NULL;
+    num_buckets = 0;
+}
+
+void stop_mate_search() {
+    __atomic_store_n(&stop_flag, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t node_key(Position *pos, int remaining) {
+    return pos->hash ^ (uint64_t)(remaining + 1) * PLY_SPREAD;
+}
+
+// Same multiply-shift indexing as the transposition table
+static inline MateBucket *get_bucket(uint64_t key) {
+    return &buckets[((key & 0xFFFFFFFF) * num_buckets) >> 32];
+}
+
+static MateEntry *find(uint64_t key) {
+    MateBucket *bucket = get_bucket(key);
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        if (bucket->entries[i].key == key)
+            return &bucket->entries[i];
+    }
+
+    return NULL;
+}
+
+static void store(uint64_t key, uint32_t pn, uint32_t dn, uint64_t work,
+                  Move move) {
+    MateBucket *bucket = get_bucket(key);
+    MateEntry *slot = &bucket->entries[0];
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        MateEntry *entry = &bucket->entries[i];
+        if (entry->key == key) {
+            slot = entry;
+            break;
+        }
+        if (entry->work < slot->work)
+            slot = entry;
+    }
+
+    slot->key = key;
+    slot->pn = pn;
+    slot->dn = dn;
+    slot->work = work < 0xFFFFFFFFULL ? (uint32_t)work : 0xFFFFFFFFU;
+    slot->move = move;
+}
+
+static bool out_of_budget() {
+    if (__atomic_load_n(&stop_flag, __ATOMIC_RELAXED))
+        return true;
+
+    if ((limit_nodes && nodes >= node_limit) ||
+        (deadline && nodes >= next_time_check && now() >= deadline)) {
+        stop_mate_search();
+        return true;
+    }
+
+    if (nodes >= next_time_check)
+        next_time_check = nodes + TIME_CHECK_INTERVAL;
+    return false;
+}
+
+static inline uint32_t add_capped(uint32_t a, uint32_t b) {
+    if (a == PN_INF || b == PN_INF)
+        return PN_INF;
+    return a + b < PN_INF - 1 ? a + b : PN_INF - 1;
+}
+
+static inline uint32_t min_capped(uint64_t a, uint64_t b) {
+    uint64_t min = a < b ? a : b;
+    return min < PN_INF ? (uint32_t)min : PN_INF;
+}
+
+/**
+ * Search the node of pos, remaining plies before the attacker's last move
+ * must have mated, until its proof number reaches max_pn or its disproof
+ * number max_dn (or the limits are hit). Both numbers are returned in pn and
+ * dn and stored in the table.
+ *
+ * The attacker moves with an odd number of plies remaining. It needs one
+ * move that leads to mate, so its proof number is the minimum over its moves
+ * and its disproof number the sum; the defender's node is the reverse.
+ */
+static void mid(Position *pos, int remaining, uint64_t key, uint32_t max_pn,
+                uint32_t max_dn, uint32_t *pn, uint32_t *dn) {
+    uint64_t start = nodes++;
+    bool attacker = remaining % 2 == 1;
+    int color = pos->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+
+    // Out of plies the defender only matters if it's already mated
+    MateFrame *frame = &frames[remaining];
+    Move *moves = frame->moves;
+    int count = remaining > 0 || king_attacked(pos, color)
+                    ? generate_moves(pos, moves)
+                    : 0;
+
+    // With one ply left only checks can mate
+    if (remaining == 1) {
+        CheckInfo ci;
+        init_check_info(pos, &ci);
+        int checks = 0;
+        for (int i = 0; i < count; i++) {
+            if (gives_check(pos, &ci, moves[i]))
+                moves[checks++] = moves[i];
+        }
+        count = checks;
+    }
+
+    if (count == 0 || remaining == 0) {
+        bool mated = !attacker && count == 0 && king_attacked(pos, color);
+        *pn = mated ? 0 : PN_INF;
+        *dn = mated ? PN_INF : 0;
+        store(key, *pn, *dn, 1, 0);
+        return;
+    }
+
+    uint64_t *keys = frame->keys;
+    uint32_t *child_pn = frame->pn, *child_dn = frame->dn;
+    for (int i = 0; i < count; i++) {
+        Position child = *pos;
+        execute_move(&child, moves[i]);
+        keys[i] = node_key(&child, remaining - 1);
+        MateEntry *entry = find(keys[i]);
+        child_pn[i] = entry ? entry->pn : 1;
+        child_dn[i] = entry ? entry->dn : 1;
+    }
+
+    int best;
+    for (;;) {
+        // The number the side to move minimizes over its moves (phi) and the
+        // one it sums (delta), from the children's proof and disproof numbers
+        uint32_t phi = PN_INF, second = PN_INF, delta = 0;
+        best = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t child_phi = attacker ? child_pn[i] : child_dn[i];
+            uint32_t child_delta = attacker ? child_dn[i] : child_pn[i];
+            delta = add_capped(delta, child_delta);
+            if (child_phi < phi) {
+                second = phi;
+                phi = child_phi;
+                best = i;
+            } else if (child_phi < second) {
+                second = child_phi;
+            }
+        }
+
+        *pn = attacker ? phi : delta;
+        *dn = attacker ? delta : phi;
+        uint32_t max_phi = attacker ? max_pn : max_dn;
+        uint32_t max_delta = attacker ? max_dn : max_pn;
+        if (phi >= max_phi || delta >= max_delta || out_of_budget())
+            break;
+
+        // Stay on the best move until it is no longer better than the second
+        // best, or its share of delta would push ours over the threshold
+        uint32_t best_delta = attacker ? child_dn[best] : child_pn[best];
+        uint32_t child_phi_limit = min_capped(max_phi, (uint64_t)second + 1);
+        uint32_t child_delta_limit =
+            min_capped(PN_INF, (uint64_t)max_delta - delta + best_delta);
+
+        Position child = *pos;
+        execute_move(&child, moves[best]);
+        mid(&child, remaining - 1, keys[best],
+            attacker ? child_phi_limit : child_delta_limit,
+            attacker ? child_delta_limit : child_phi_limit, &child_pn[best],
+            &child_dn[best]);
+    }
+
+    store(key, *pn, *dn, nodes - start,
+          attacker && *pn == 0 ? moves[best] : 0);
+}
+
+// Whether the attacker to move in pos mates within remaining plies. False if
+// the limits were hit before that was settled.
+static bool prove(Position *pos, int remaining) {
+    uint64_t key = node_key(pos, remaining);
+    MateEntry *entry = find(key);
+    if (entry && (entry->pn == 0 || entry->dn == 0))
+        return entry->pn == 0;
+    if (out_of_budget())
+        return false;
+
+    uint32_t pn, dn;
+    mid(pos, remaining, key, PN_INF, PN_INF, &pn, &dn);
+    return pn == 0;
+}
+
+// The fewest plies (odd, at most max_plies) the attacker to move in pos
+// needs to mate, or 0.
+static int shortest_mate(Position *pos, int max_plies) {
+    for (int plies = 1; plies <= max_plies; plies += 2) {
+        if (prove(pos, plies))
+            return plies;
+        if (out_of_budget())
+            break;
+    }
+
+    return 0;
+}
+
+// Follow the proof from pos, where the attacker mates in plies: its proven
+// moves, and the defender's replies that delay the mate the longest.
+static void extract_pv(Position *pos, int plies, MateResult *result) {
+    while (result->pv_length < MAX_PLY - 1) {
+        MateEntry *entry = find(node_key(pos, plies));
+        if (!entry || entry->pn != 0 || !entry->move)
+            return;
+
+        result->pv[result->pv_length++] = entry->move;
+        execute_move(pos, entry->move);
+
+        Move moves[256];
+        int count = generate_moves(pos, moves);
+        Move reply = 0;
+        int longest = 0;
+        for (int i = 0; i < count; i++) {
+            Position child = *pos;
+            execute_move(&child, moves[i]);
+            int reply_plies = shortest_mate(&child, plies - 2);
+            if (reply_plies == 0)
+                return; // out of budget
+            if (reply_plies > longest) {
+                longest = reply_plies;
+                reply = moves[i];
+            }
+        }
+
+        if (!reply)
+            return; // mated
+        result->pv[result->pv_length++] = reply;
+        execute_move(pos, reply);
+        plies = longest;
+    }
+}
+
+bool search_mate(Position *pos, int max_moves, int64_t max_nodes,
+                 float move_time, MateResult *result) {
+    double start = now();
+    __atomic_store_n(&stop_flag, 0, __ATOMIC_RELAXED);
+    nodes = 0;
+    limit_nodes = max_nodes >= 0;
+    node_limit = limit_nodes ? (uint64_t)max_nodes : 0;
+    deadline = move_time >= 0 ? start + move_time / 1000.0 : 0;
+    next_time_check = TIME_CHECK_INTERVAL;
+    result->moves = 0;
+    result->pv_length = 0;
+
+    if (!buckets) {
+        resize_mate_table(MATE_TABLE_DEFAULT_MB);
+    } else {
+        memset(buckets, 0, num_buckets * sizeof(MateBucket));
+    }
+    if (!frames)
+        frames = malloc(MAX_PLY * sizeof(MateFrame));
+
+    int plies = 0;
+    if (buckets && frames) {
+        if (max_moves > MATE_MAX_MOVES)
+            max_moves = MATE_MAX_MOVES;
+
+        Position root = *pos;
+        plies = shortest_mate(&root, 2 * max_moves - 1);
+        if (plies) {
+            result->moves = (plies + 1) / 2;
+            extract_pv(&root, plies, result);
+        }
+    }
+
+    result->nodes = nodes;
+    result->time_ms = (int)((now() - start) * 1000);
+    return plies != 0;
+}
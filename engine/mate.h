@@ -0,0 +1,58 @@
+#ifndef MATE_H
+#define MATE_H
+#include "search.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Mate solver for `go mate`, separate from the alpha-beta search. It runs a
+ * depth-first proof-number search (df-pn): instead of searching every move to
+ * a fixed depth it keeps expanding the move that is closest to being proven
+ * (fewest positions left to prove mate) or disproven, so it goes deep along
+ * forcing lines and spends little time on quiet ones.
+ *
+ * Proof and disproof numbers are kept in a node table of its own, bounded by
+ * its size in megabytes; when a bucket is full the entry with the least work
+ * below it is replaced. The remaining number of plies is part of each key, so
+ * the search graph has no cycles even when positions repeat.
+ */
+#define MATE_TABLE_DEFAULT_MB 16
+#define MATE_MAX_MOVES (MAX_PLY / 2)
+
+/**
+ * Reallocate the node table to use mb megabytes. Returns false if the
+ * allocation failed, in which case the next search_mate() falls back to the
+ * default size.
+ */
+bool resize_mate_table(size_t mb);
+void free_mate_table();
+
+typedef struct {
+    // Mate in this many moves, 0 if none was found
+    int moves;
+    uint64_t nodes;
+    int time_ms;
+    // The mating line, with the defender's longest resistance. It can be cut
+    // short if the limits were hit while it was being extracted.
+    int pv_length;
+    Move pv[MAX_PLY];
+} MateResult;
+
+/**
+ * Look for a mate by the side to move in at most max_moves moves (capped at
+ * MATE_MAX_MOVES), trying every length from 1 up so the mate found is the
+ * shortest. nodes and move_time (ms) limit the search (0 is a limit too), -1
+ * excludes them.
+ * Returns true and fills result if a mate was proven; result->nodes and
+ * time_ms are set either way.
+ */
+bool search_mate(Position *pos, int max_moves, int64_t nodes, float move_time,
+                 MateResult *result);
+
+/**
+ * Ask a running search_mate() to stop, safe to call from another thread. Like
+ * stop_search(), a request made before the search starts is ignored.
+ */
+void stop_mate_search();
+#endif // MATE_H
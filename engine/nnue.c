@@ -0,0 +1,277 @@
+#include "nnue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NNUE_MMAP
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define NNUE_VERSION 1
+
+// Quantization of the trained float network: feature weights and hidden
+// activations are scaled by QA, output weights by QB and the output bias by
+// QA * QB. SCALE converts the output to centipawns.
+#define QA 255
+#define QB 64
+#define SCALE 400
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t king_buckets;
+    uint32_t hidden;
+} NetHeader;
+
+#define NET_SIZE                                                               \
+    (sizeof(NetHeader) +                                                       \
+     sizeof(int16_t) *                                                         \
+         ((size_t)NNUE_INPUTS * NNUE_HIDDEN + 3 * NNUE_HIDDEN + 1))
+
+typedef struct {
+    const int16_t *feature_weights; // [NNUE_INPUTS][NNUE_HIDDEN]
+    const int16_t *feature_bias;
+    const int16_t *output_weights; // side to move's half first
+    int16_t output_bias;
+} Network;
+
+static Network net;
+static bool loaded = false;
+static void *net_memory = NULL;
+static bool net_mapped = false;
+
+// Maps the file if possible, so the weights are shared with the page cache
+// instead of copied.
+static void *read_net(const char *path, bool *mapped) {
+#ifdef NNUE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == NET_SIZE) {
+        mem = mmap(NULL, NET_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mem != MAP_FAILED) {
+        *mapped = true;
+        return mem;
+    }
+#endif
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    void *buffer = malloc(NET_SIZE + 1);
+    // Reading one byte more than expected catches files that are too long
+    if (buffer && fread(buffer, 1, NET_SIZE + 1, file) != NET_SIZE) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    *mapped = false;
+    return buffer;
+}
+
+static void release_net(void *memory, bool mapped) {
+#ifdef NNUE_MMAP
+    if (mapped) {
+        munmap(memory, NET_SIZE);
+        return;
+    }
+#endif
+    free(memory);
+}
+
+bool nnue_load(const char *path) {
+    bool mapped;
+    void *memory = read_net(path, &mapped);
+    if (!memory) {
+        return false;
+    }
+
+    NetHeader header;
+    memcpy(&header, memory, sizeof(header));
+    if (memcmp(header.magic, "GCEN", 4) != 0 ||
+        header.version != NNUE_VERSION ||
+        header.king_buckets != NNUE_KING_BUCKETS ||
+        header.hidden != NNUE_HIDDEN) {
+        release_net(memory, mapped);
+        return false;
+    }
+
+    nnue_unload();
+    net_memory = memory;
+    net_mapped = mapped;
+
+    const int16_t *weights =
+        (const int16_t *)((const char *)memory + sizeof(NetHeader));
+    net.feature_weights = weights;
+    weights += (size_t)NNUE_INPUTS * NNUE_HIDDEN;
+    net.feature_bias = weights;
+    weights += NNUE_HIDDEN;
+    net.output_weights = weights;
+    weights += 2 * NNUE_HIDDEN;
+    memcpy(&net.output_bias, weights, sizeof(int16_t));
+
+    loaded = true;
+    return true;
+}
+
+void nnue_unload() {
+    if (net_memory) {
+        release_net(net_memory, net_mapped);
+    }
+    net_memory = NULL;
+    loaded = false;
+}
+
+bool nnue_enabled() { return loaded; }
+
+// Zones of the king square as seen by its own side: the back rank and the
+// rest of the board, each split into queen and king side.
+static inline int king_bucket(int sq) { return (sq >= 8) * 2 + (sq % 8 >= 4); }
+
+static inline int feature(int perspective, int king_sq, int piece, int sq) {
+    if (perspective) {
+        sq ^= 56;
+        king_sq ^= 56;
+    }
+    int theirs = (PIECE_COLOR(piece) == PIECE_BLACK) != perspective;
+    return ((king_bucket(king_sq) * 2 + theirs) * 6 + PIECE_TYPE(piece)) * 64 +
+           sq;
+}
+
+// Plain loops, the compiler vectorizes them for whatever target is enabled.
+static inline void add_feature(int16_t *values, int index) {
+    const int16_t *row = net.feature_weights + (size_t)index * NNUE_HIDDEN;
+    for (int i = 0; i < NNUE_HIDDEN; i++)
+        values[i] += row[i];
+}
+
+static inline void sub_feature(int16_t *values, int index) {
+    const int16_t *row = net.feature_weights + (size_t)index * NNUE_HIDDEN;
+    for (int i = 0; i < NNUE_HIDDEN; i++)
+        values[i] -= row[i];
+}
+
+static inline int king_square(Position *pos, int perspective) {
+    int color = perspective ? PIECE_BLACK : PIECE_WHITE;
+    return __builtin_ctzll(pos->bitboards[color | PIECE_KING]);
+}
+
+static void refresh_perspective(int16_t *values, Position *pos,
+                                int perspective) {
+    memcpy(values, net.feature_bias, sizeof(int16_t) * NNUE_HIDDEN);
+    int king_sq = king_square(pos, perspective);
+    for (int piece = 0; piece < MAX_PIECE; piece++) {
+        if (PIECE_TYPE(piece) > PIECE_KING)
+            continue;
+        FOREACH_SET_BIT(pos->bitboards[piece], sq) {
+            add_feature(values, feature(perspective, king_sq, piece, sq));
+        }
+    }
+}
+
+void nnue_refresh(Accumulator *acc, Position *pos) {
+    refresh_perspective(acc->values[0], pos, 0);
+    refresh_perspective(acc->values[1], pos, 1);
+}
+
+void nnue_update(Accumulator *acc, const Accumulator *parent, Position *pos) {
+    const DirtyPieces *dirty = &pos->dirty;
+    for (int perspective = 0; perspective < 2; perspective++) {
+        int king = (perspective ? PIECE_BLACK : PIECE_WHITE) | PIECE_KING;
+        int orient = perspective ? 56 : 0;
+        bool refresh = false;
+        for (int i = 0; i < dirty->count; i++) {
+            if (dirty->piece[i] == king &&
+                king_bucket(dirty->from[i] ^ orient) !=
+                    king_bucket(dirty->to[i] ^ orient))
+                refresh = true;
+        }
+
+        int16_t *values = acc->values[perspective];
+        if (refresh) {
+            refresh_perspective(values, pos, perspective);
+            continue;
+        }
+
+        memcpy(values, parent->values[perspective], sizeof(acc->values[0]));
+        int king_sq = king_square(pos, perspective);
+        for (int i = 0; i < dirty->count; i++) {
+            if (dirty->from[i] >= 0)
+                sub_feature(values, feature(perspective, king_sq,
+                                            dirty->piece[i], dirty->from[i]));
+            if (dirty->to[i] >= 0)
+                add_feature(values, feature(perspective, king_sq,
+                                            dirty->piece[i], dirty->to[i]));
+        }
+    }
+}
+
+// Sum of clamp(values[i], 0, QA) * weights[i]. Activations are at most 8 bits,
+// so the 16-bit multiply-add can't overflow its 32-bit pair sums.
+static int32_t crelu_dot(const int16_t *values, const int16_t *weights) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i qa = _mm256_set1_epi16(QA);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i w = _mm256_loadu_si256((const __m256i *)(weights + i));
+        v = _mm256_min_epi16(_mm256_max_epi16(v, zero), qa);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v, w));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                              _mm256_extracti128_si256(sum, 1));
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i qa = _mm_set1_epi16(QA);
+    __m128i s = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        __m128i w = _mm_loadu_si128((const __m128i *)(weights + i));
+        v = _mm_min_epi16(_mm_max_epi16(v, zero), qa);
+        s = _mm_add_epi32(s, _mm_madd_epi16(v, w));
+    }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        int v = values[i] < 0 ? 0 : values[i] > QA ? QA : values[i];
+        sum += v * weights[i];
+    }
+
+    return sum;
+#endif
+}
+
+int nnue_evaluate(const Accumulator *acc, Position *pos) {
+    int us = pos->moves % 2;
+    int64_t output = (int64_t)crelu_dot(acc->values[us], net.output_weights) +
+                     crelu_dot(acc->values[!us], net.output_weights +
+                                                     NNUE_HIDDEN) +
+                     net.output_bias;
+    int eval = (int)(output * SCALE / (QA * QB));
+    return us == 0 ? eval : -eval;
+}
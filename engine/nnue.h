@@ -0,0 +1,51 @@
+#ifndef NNUE_H
+#define NNUE_H
+#include "position.h"
+#include <stdbool.h>
+
+/**
+ * Optional neural network evaluation. The network has one hidden layer per
+ * perspective (side to move and opponent), fed by king-bucketed piece-square
+ * features: for each perspective, every piece on the board activates one input
+ * chosen by its type, whether it belongs to that side, its square (flipped for
+ * black) and which of NNUE_KING_BUCKETS zones that side's king is in. The two
+ * hidden layers go through a clipped ReLU into a single output neuron.
+ *
+ * The hidden layers (accumulators) only change by a few rows per move, so the
+ * search keeps one per ply and updates it from Position::dirty instead of
+ * recomputing it, unless the king changed bucket.
+ *
+ * Network files are little-endian: a 16-byte header ("GCEN", version, king
+ * buckets, hidden size as uint32) followed by int16 feature weights
+ * [inputs][hidden], feature biases [hidden], output weights [2 * hidden] and
+ * the output bias.
+ */
+#define NNUE_KING_BUCKETS 4
+#define NNUE_INPUTS (NNUE_KING_BUCKETS * 12 * 64)
+#define NNUE_HIDDEN 256
+
+typedef struct {
+    // Indexed by color (0 white, 1 black)
+    int16_t values[2][NNUE_HIDDEN];
+} Accumulator;
+
+/**
+ * Map the network in the file at path and use it for evaluation. Returns false
+ * if it can't be read or doesn't match the expected layout, in which case the
+ * previous network (if any) is kept.
+ */
+bool nnue_load(const char *path);
+// Go back to the handcrafted evaluation.
+void nnue_unload();
+bool nnue_enabled();
+
+// Compute both perspectives of the accumulator from scratch.
+void nnue_refresh(Accumulator *acc, Position *pos);
+
+// Compute the accumulator of pos, which execute_move() produced from the
+// position parent belongs to.
+void nnue_update(Accumulator *acc, const Accumulator *parent, Position *pos);
+
+// Network output in centipawns from white's perspective.
+int nnue_evaluate(const Accumulator *acc, Position *pos);
+#endif // NNUE_H
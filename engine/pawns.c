@@ -0,0 +1,117 @@
+#include "pawns.h"
+#include "eval.h"
+
+#define FILE_A 0x0101010101010101ULL
+#define FILE_H 0x8080808080808080ULL
+
+#define DOUBLED S(-11, -24)
+#define ISOLATED S(-9, -13)
+#define BACKWARD S(-7, -9)
+
+// Passed pawn bonus by rank relative to the pawn's side. The piece-square
+// tables already reward advanced pawns, this is what being unstoppable by
+// pawns adds on top.
+static const Score passed_bonus[8] = {
+    S(0, 0),   S(2, 6),   S(3, 9),   S(8, 18),
+    S(16, 34), S(28, 60), S(42, 90), S(0, 0),
+};
+
+// Per shield pawn directly in front of the king, and one rank further up.
+#define SHIELD_NEAR S(11, 0)
+#define SHIELD_FAR S(5, 0)
+
+static inline uint64_t north_fill(uint64_t bb) {
+    bb |= bb << 8;
+    bb |= bb << 16;
+    return bb | bb << 32;
+}
+
+static inline uint64_t south_fill(uint64_t bb) {
+    bb |= bb >> 8;
+    bb |= bb >> 16;
+    return bb | bb >> 32;
+}
+
+static inline uint64_t adjacent_files(uint64_t bb) {
+    return ((bb & ~FILE_A) >> 1) | ((bb & ~FILE_H) << 1);
+}
+
+// Sums bonus over the pawns in bb, counting black's ranks from their side.
+static Score passed_score(uint64_t bb, int color) {
+    Score score = 0;
+    FOREACH_SET_BIT(bb, sq) {
+        score += passed_bonus[color == PIECE_WHITE ? sq / 8 : 7 - sq / 8];
+    }
+
+    return score;
+}
+
+static void evaluate_pawns(Position *p, PawnEntry *e) {
+    uint64_t white = p->bitboards[PIECE_WHITE | PIECE_PAWN];
+    uint64_t black = p->bitboards[PIECE_BLACK | PIECE_PAWN];
+
+    e->attacks[0] = ((white & ~FILE_A) << 7) | ((white & ~FILE_H) << 9);
+    e->attacks[1] = ((black & ~FILE_A) >> 9) | ((black & ~FILE_H) >> 7);
+    e->attack_span[0] = north_fill(e->attacks[0]);
+    e->attack_span[1] = south_fill(e->attacks[1]);
+
+    // Squares in front of the pawns, on their own and the adjacent files
+    uint64_t white_front = north_fill(white) << 8;
+    uint64_t black_front = south_fill(black) >> 8;
+    e->passed[0] = white & ~(black_front | adjacent_files(black_front));
+    e->passed[1] = black & ~(white_front | adjacent_files(white_front));
+
+    // The rear pawn of a doubled pair is the one penalized
+    int doubled = __builtin_popcountll(white & south_fill(white) >> 8) -
+                  __builtin_popcountll(black & north_fill(black) << 8);
+
+    uint64_t white_files = north_fill(south_fill(white));
+    uint64_t black_files = north_fill(south_fill(black));
+    int isolated = __builtin_popcountll(white & ~adjacent_files(white_files)) -
+                   __builtin_popcountll(black & ~adjacent_files(black_files));
+
+    // A pawn whose stop square is attacked by an enemy pawn and can't be
+    // defended by a pawn of its own, even after they advance
+    uint64_t white_backward =
+        (((white << 8) & e->attacks[1]) & ~e->attack_span[0]) >> 8;
+    uint64_t black_backward =
+        (((black >> 8) & e->attacks[0]) & ~e->attack_span[1]) << 8;
+    int backward = __builtin_popcountll(white_backward) -
+                   __builtin_popcountll(black_backward);
+
+    e->score = doubled * DOUBLED + isolated * ISOLATED + backward * BACKWARD +
+               passed_score(e->passed[0], PIECE_WHITE) -
+               passed_score(e->passed[1], PIECE_BLACK);
+}
+
+void probe_pawns(PawnTable *table, Position *p, PawnEntry *entry) {
+    if (!table) {
+        evaluate_pawns(p, entry);
+        entry->key = p->pawn_hash;
+        return;
+    }
+
+    PawnEntry *slot = &table->entries[p->pawn_hash % PAWN_TABLE_SIZE];
+#ifdef GCE_SEARCH_STATS
+    table->probes++;
+    table->hits += slot->key == p->pawn_hash;
+#endif
+    if (slot->key != p->pawn_hash) {
+        evaluate_pawns(p, slot);
+        slot->key = p->pawn_hash;
+    }
+
+    *entry = *slot;
+}
+
+Score pawn_shield(Position *p, int color) {
+    uint64_t king = p->bitboards[color | PIECE_KING];
+    uint64_t pawns = p->bitboards[color | PIECE_PAWN];
+    uint64_t near = color == PIECE_WHITE ? king << 8 : king >> 8;
+    uint64_t far = color == PIECE_WHITE ? king << 16 : king >> 16;
+    near |= adjacent_files(near);
+    far |= adjacent_files(far);
+
+    return __builtin_popcountll(pawns & near) * SHIELD_NEAR +
+           __builtin_popcountll(pawns & far) * SHIELD_FAR;
+}
@@ -3,8 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "eval.h"
 #include "position.h"
 #include "tables.h"
+#include "zobrist.h"
 
 #include <string.h>
 
@@ -117,6 +119,10 @@ Position *position_from_fen(const char *fen_string) {
     fen = strtok(NULL, " ");
     int moves = atoi(fen);
     p->moves = (moves - 1) * 2 + (strcmp(side_to_move, "b") == 0 ? 1 : 0);
+    p->hash = position_zobrist(p);
+    p->pawn_hash = position_pawn_zobrist(p);
+    p->psq = position_psq(p);
+    p->phase = position_phase(p);
     return p;
 }
 
@@ -244,6 +250,131 @@ uint64_t generate_attacks(Position *p, int color) {
     return attacks;
 }
 
+bool king_attacked(Position *p, int color) {
+    int opp = color ^ 8;
+    uint64_t king_bb = p->bitboards[color | PIECE_KING];
+    if (!king_bb)
+        return false;
+
+    int king = __builtin_ctzll(king_bb);
+    uint64_t occupied = GET_OCCUPIED(p);
+    // squares enemy pawns would attack the king from
+    uint64_t pawn_squares =
+        color == PIECE_WHITE
+            ? ((king_bb & ~FILE_A) << 7) | ((king_bb & ~FILE_H) << 9)
+            : ((king_bb & ~FILE_H) >> 7) | ((king_bb & ~FILE_A) >> 9);
+    uint64_t diagonal =
+        p->bitboards[opp | PIECE_BISHOP] | p->bitboards[opp | PIECE_QUEEN];
+    uint64_t straight =
+        p->bitboards[opp | PIECE_ROOK] | p->bitboards[opp | PIECE_QUEEN];
+    return (pawn_squares & p->bitboards[opp | PIECE_PAWN]) ||
+           (knight_moves[king] & p->bitboards[opp | PIECE_KNIGHT]) ||
+           (king_moves[king] & p->bitboards[opp | PIECE_KING]) ||
+           (get_bishop_attacks(occupied, king) & diagonal) ||
+           (get_rook_attacks(occupied, king) & straight);
+}
+
+void init_check_info(Position *p, CheckInfo *ci) {
+    int color = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+    int opp = color ^ 8;
+    uint64_t occupied = GET_OCCUPIED(p);
+    uint64_t king_bb = p->bitboards[opp | PIECE_KING];
+    int king = __builtin_ctzll(king_bb);
+
+    // squares our pawns would attack the king from
+    if (color == PIECE_WHITE) {
+        ci->check_squares[PIECE_PAWN] =
+            ((king_bb & ~FILE_H) >> 7) | ((king_bb & ~FILE_A) >> 9);
+    } else {
+        ci->check_squares[PIECE_PAWN] =
+            ((king_bb & ~FILE_A) << 7) | ((king_bb & ~FILE_H) << 9);
+    }
+
+    ci->king = king;
+    ci->check_squares[PIECE_KNIGHT] = knight_moves[king];
+    ci->check_squares[PIECE_BISHOP] = get_bishop_attacks(occupied, king);
+    ci->check_squares[PIECE_ROOK] = get_rook_attacks(occupied, king);
+    ci->check_squares[PIECE_QUEEN] =
+        ci->check_squares[PIECE_BISHOP] | ci->check_squares[PIECE_ROOK];
+    ci->check_squares[PIECE_KING] = 0;
+
+    uint64_t diagonal =
+        p->bitboards[color | PIECE_BISHOP] | p->bitboards[color | PIECE_QUEEN];
+    uint64_t straight =
+        p->bitboards[color | PIECE_ROOK] | p->bitboards[color | PIECE_QUEEN];
+    uint64_t snipers = (diagonal & get_bishop_attacks(0ULL, king)) |
+                       (straight & get_rook_attacks(0ULL, king));
+
+    ci->discoverers = 0;
+    FOREACH_SET_BIT(snipers, sniper) {
+        uint64_t blockers = squares_between[king][sniper] & occupied;
+        if (__builtin_popcountll(blockers) == 1)
+            ci->discoverers |= blockers & GET_COLOR_OCCUPIED(p, color);
+    }
+}
+
+// Whether any of color's sliders attack sq given the occupancy.
+static bool slider_attacks(Position *p, int color, uint64_t occupied, int sq) {
+    uint64_t diagonal =
+        p->bitboards[color | PIECE_BISHOP] | p->bitboards[color | PIECE_QUEEN];
+    uint64_t straight =
+        p->bitboards[color | PIECE_ROOK] | p->bitboards[color | PIECE_QUEEN];
+    return (get_bishop_attacks(occupied, sq) & diagonal) ||
+           (get_rook_attacks(occupied, sq) & straight);
+}
+
+bool gives_check(Position *p, const CheckInfo *ci, Move move) {
+    int color = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+    int from = MOVE_FROM(move), to = MOVE_TO(move);
+    uint64_t from_bb = 1ULL << from, to_bb = 1ULL << to;
+
+    int piece = PIECE_PAWN;
+    for (int i = 0; i < 6; i++) {
+        if (p->bitboards[color | i] & from_bb) {
+            piece = i;
+            break;
+        }
+    }
+
+    if (MOVE_PROMO(move) == 0 && (ci->check_squares[piece] & to_bb))
+        return true;
+
+    // Discovered check, unless the piece stays on the line to the king
+    if ((ci->discoverers & from_bb) &&
+        !(squares_between[ci->king][from] & to_bb) &&
+        !(squares_between[ci->king][to] & from_bb))
+        return true;
+
+    // The rare cases change more than one square, so just look at the result
+    uint64_t occupied = (GET_OCCUPIED(p) & ~from_bb) | to_bb;
+    if (MOVE_PROMO(move) != 0) {
+        int promo = MOVE_PROMO(move);
+        if (promo == PIECE_KNIGHT)
+            return knight_moves[to] & (1ULL << ci->king);
+        uint64_t attacks = 0;
+        if (promo != PIECE_ROOK)
+            attacks |= get_bishop_attacks(occupied, to);
+        if (promo != PIECE_BISHOP)
+            attacks |= get_rook_attacks(occupied, to);
+        return attacks & (1ULL << ci->king);
+    }
+
+    if (piece == PIECE_PAWN && to_bb == p->en_passant) {
+        int capture_sq = color == PIECE_WHITE ? to - 8 : to + 8;
+        occupied &= ~(1ULL << capture_sq);
+        return slider_attacks(p, color, occupied, ci->king);
+    }
+
+    if (piece == PIECE_KING && (from - to == 2 || to - from == 2)) {
+        int rook_from = to > from ? from + 3 : from - 4;
+        int rook_to = to > from ? from + 1 : from - 1;
+        occupied = (occupied & ~(1ULL << rook_from)) | (1ULL << rook_to);
+        return get_rook_attacks(occupied, rook_to) & (1ULL << ci->king);
+    }
+
+    return false;
+}
+
 static void add_pawn_moves(uint64_t bb, int shift, Move *arr,
                            int *moves_count) {
     while (bb) {
@@ -649,6 +780,30 @@ int generate_moves(Position *p, Move *arr) {
     return moves_count;
 }
 
+static inline void add_dirty(Position *p, int piece, int from, int to) {
+    DirtyPieces *dirty = &p->dirty;
+    dirty->piece[dirty->count] = piece;
+    dirty->from[dirty->count] = from;
+    dirty->to[dirty->count] = to;
+    dirty->count++;
+}
+
+#define CASTLE_DIRTY(color, king_from, king_to, rook_from, rook_to)            \
+    (add_dirty(p, (color) | PIECE_KING, king_from, king_to),                   \
+     add_dirty(p, (color) | PIECE_ROOK, rook_from, rook_to))
+
+#define CASTLE_HASH(color, king_from, king_to, rook_from, rook_to)             \
+    (ZOBRIST_PIECE((color) | PIECE_KING, king_from) ^                          \
+     ZOBRIST_PIECE((color) | PIECE_KING, king_to) ^                            \
+     ZOBRIST_PIECE((color) | PIECE_ROOK, rook_from) ^                          \
+     ZOBRIST_PIECE((color) | PIECE_ROOK, rook_to))
+
+#define CASTLE_PSQ(color, king_from, king_to, rook_from, rook_to)              \
+    (psq_value((color) | PIECE_KING, king_to) -                                \
+     psq_value((color) | PIECE_KING, king_from) +                              \
+     psq_value((color) | PIECE_ROOK, rook_to) -                                \
+     psq_value((color) | PIECE_ROOK, rook_from))
+
 void execute_move(Position *p, Move move) {
     int color = (GET_COLOR_OCCUPIED(p, PIECE_WHITE) & (1ULL << MOVE_FROM(move)))
                     ? PIECE_WHITE
@@ -660,6 +815,11 @@ void execute_move(Position *p, Move move) {
     uint64_t from_bb = 1ULL << MOVE_FROM(move);
     uint64_t to_bb = 1ULL << MOVE_TO(move);
     bool capture = false;
+    // remove castling/ep/side now, they're added back once they're updated
+    uint64_t hash = p->hash ^ zobrist_state(p);
+    uint64_t pawn_hash = p->pawn_hash;
+    Score psq = p->psq;
+    p->dirty.count = 0;
 
     // handle castling
     if (p->bitboards[color | PIECE_KING] & from_bb) {
@@ -671,11 +831,17 @@ void execute_move(Position *p, Move move) {
                 p->bitboards[PIECE_WHITE | PIECE_ROOK] &= ~(1ULL << 7);
                 p->bitboards[PIECE_WHITE | PIECE_ROOK] |= (1ULL << 5);
                 p->bitboards[PIECE_WHITE | PIECE_KING] = (1ULL << 6);
+                hash ^= CASTLE_HASH(PIECE_WHITE, 4, 6, 7, 5);
+                psq += CASTLE_PSQ(PIECE_WHITE, 4, 6, 7, 5);
+                CASTLE_DIRTY(PIECE_WHITE, 4, 6, 7, 5);
                 goto end;
             case ENCODE_MOVE(4, 2, 0):
                 p->bitboards[PIECE_WHITE | PIECE_ROOK] &= ~(1ULL << 0);
                 p->bitboards[PIECE_WHITE | PIECE_ROOK] |= (1ULL << 3);
                 p->bitboards[PIECE_WHITE | PIECE_KING] = (1ULL << 2);
+                hash ^= CASTLE_HASH(PIECE_WHITE, 4, 2, 0, 3);
+                psq += CASTLE_PSQ(PIECE_WHITE, 4, 2, 0, 3);
+                CASTLE_DIRTY(PIECE_WHITE, 4, 2, 0, 3);
                 goto end;
             }
         case PIECE_BLACK:
@@ -684,11 +850,17 @@ void execute_move(Position *p, Move move) {
                 p->bitboards[PIECE_BLACK | PIECE_ROOK] &= ~(1ULL << 56);
                 p->bitboards[PIECE_BLACK | PIECE_ROOK] |= (1ULL << 59);
                 p->bitboards[PIECE_BLACK | PIECE_KING] = (1ULL << 58);
+                hash ^= CASTLE_HASH(PIECE_BLACK, 60, 58, 56, 59);
+                psq += CASTLE_PSQ(PIECE_BLACK, 60, 58, 56, 59);
+                CASTLE_DIRTY(PIECE_BLACK, 60, 58, 56, 59);
                 goto end;
             case ENCODE_MOVE(60, 62, 0):
                 p->bitboards[PIECE_BLACK | PIECE_ROOK] &= ~(1ULL << 63);
                 p->bitboards[PIECE_BLACK | PIECE_ROOK] |= (1ULL << 61);
                 p->bitboards[PIECE_BLACK | PIECE_KING] = (1ULL << 62);
+                hash ^= CASTLE_HASH(PIECE_BLACK, 60, 62, 63, 61);
+                psq += CASTLE_PSQ(PIECE_BLACK, 60, 62, 63, 61);
+                CASTLE_DIRTY(PIECE_BLACK, 60, 62, 63, 61);
                 goto end;
             }
         }
@@ -708,10 +880,26 @@ void execute_move(Position *p, Move move) {
     }
 
     p->bitboards[moving_piece | color] &= ~from_bb;
+    hash ^= ZOBRIST_PIECE(moving_piece | color, MOVE_FROM(move));
+    psq -= psq_value(moving_piece | color, MOVE_FROM(move));
+    if (moving_piece == PIECE_PAWN) {
+        pawn_hash ^= ZOBRIST_PIECE(PIECE_PAWN | color, MOVE_FROM(move));
+    }
     if (MOVE_PROMO(move) == 0) {
+        add_dirty(p, moving_piece | color, MOVE_FROM(move), MOVE_TO(move));
         p->bitboards[moving_piece | color] |= to_bb;
+        hash ^= ZOBRIST_PIECE(moving_piece | color, MOVE_TO(move));
+        psq += psq_value(moving_piece | color, MOVE_TO(move));
+        if (moving_piece == PIECE_PAWN) {
+            pawn_hash ^= ZOBRIST_PIECE(PIECE_PAWN | color, MOVE_TO(move));
+        }
     } else {
         p->bitboards[MOVE_PROMO(move) | color] |= to_bb;
+        hash ^= ZOBRIST_PIECE(MOVE_PROMO(move) | color, MOVE_TO(move));
+        psq += psq_value(MOVE_PROMO(move) | color, MOVE_TO(move));
+        p->phase += phase_weights[MOVE_PROMO(move)];
+        add_dirty(p, moving_piece | color, MOVE_FROM(move), -1);
+        add_dirty(p, MOVE_PROMO(move) | color, -1, MOVE_TO(move));
     }
 
     // handle capture
@@ -721,10 +909,22 @@ void execute_move(Position *p, Move move) {
         int capture_sq =
             (color == PIECE_WHITE) ? MOVE_TO(move) - 8 : MOVE_TO(move) + 8;
         p->bitboards[opp | PIECE_PAWN] &= ~(1ULL << capture_sq);
+        hash ^= ZOBRIST_PIECE(opp | PIECE_PAWN, capture_sq);
+        pawn_hash ^= ZOBRIST_PIECE(opp | PIECE_PAWN, capture_sq);
+        psq -= psq_value(opp | PIECE_PAWN, capture_sq);
+        add_dirty(p, opp | PIECE_PAWN, capture_sq, -1);
     } else { // regular capture
         for (int i = 0; i < 6; i++) {
             if (p->bitboards[opp | i] & to_bb) {
                 p->bitboards[opp | i] &= ~to_bb;
+                hash ^= ZOBRIST_PIECE(opp | i, MOVE_TO(move));
+                psq -= psq_value(opp | i, MOVE_TO(move));
+                p->phase -= phase_weights[i];
+                add_dirty(p, opp | i, MOVE_TO(move), -1);
+                if (i == PIECE_PAWN) {
+                    pawn_hash ^=
+                        ZOBRIST_PIECE(opp | PIECE_PAWN, MOVE_TO(move));
+                }
                 capture = true;
                 // update castling rights when rook is captured
                 if (i == PIECE_ROOK) {
@@ -790,6 +990,10 @@ end: // cleanup
     } else {
         p->halfmoves = 0;
     }
+
+    p->hash = hash ^ zobrist_state(p);
+    p->pawn_hash = pawn_hash;
+    p->psq = psq;
 }
 GameOutcome position_outcome(Position *p) {
     if (p->halfmoves >= 50) {
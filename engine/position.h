@@ -1,5 +1,6 @@
 #ifndef POSITION_H
 #define POSITION_H
+#include <stdbool.h>
 #include <stdint.h>
 
 /*
@@ -52,9 +53,25 @@ enum {
     BLACK_QUEENSIDE = 8
 };
 
+// Packed middlegame/endgame score, see eval.h.
+typedef int32_t Score;
+
 typedef uint8_t GameOutcome;
 enum { ONGOING = 0, CHECKMATE = 1, DRAW = 2, STALEMATE = 3 };
 
+/**
+ * The pieces changed by the last execute_move(), for evaluators that update
+ * incrementally. A from square of -1 means the piece was added and a to
+ * square of -1 that it was removed: a capture removes the captured piece, a
+ * promotion removes the pawn and adds the new piece.
+ */
+typedef struct {
+    int count;
+    uint8_t piece[3];
+    int8_t from[3];
+    int8_t to[3];
+} DirtyPieces;
+
 typedef struct {
     uint64_t bitboards[MAX_PIECE];
     uint64_t en_passant;
@@ -62,6 +79,15 @@ typedef struct {
 
     CastlingRights castling_rights;
     int halfmoves;
+
+    // Zobrist key, kept up to date by execute_move()
+    uint64_t hash;
+    // Zobrist key of the pawns alone, for the pawn hash table
+    uint64_t pawn_hash;
+    // Material + piece-square score from white's view, see position_psq()
+    Score psq;
+    int phase;
+    DirtyPieces dirty;
 } Position;
 
 // Combines all the bitboards of the given color.
@@ -90,11 +116,32 @@ typedef struct {
     for (uint64_t _bb = (bb); _bb; _bb &= _bb - 1)                             \
         for (int sq = __builtin_ctzll(_bb), _once = 1; _once; _once = 0)
 
+/**
+ * What the side to move needs to know to tell whether a move gives check
+ * without making it: the squares each piece type would give direct check from,
+ * and its own pieces that block one of its sliders from the enemy king (moving
+ * one of them off the line gives discovered check). Fill it once per position
+ * with init_check_info() and pass it to gives_check() for every move.
+ */
+typedef struct {
+    uint64_t check_squares[6];
+    uint64_t discoverers;
+    int king;
+} CheckInfo;
+
 Position *position_from_fen(const char *fen_string);
 
 void print_position(Position *p);
 int generate_moves(Position *p, Move *arr);
 uint64_t generate_attacks(Position *p, int color);
+// Whether color's king is attacked, without generating all attacks.
+bool king_attacked(Position *p, int color);
+// Magic bitboard lookups of the squares a rook/bishop on sq attacks.
+uint64_t get_rook_attacks(uint64_t occupancy, int sq);
+uint64_t get_bishop_attacks(uint64_t occupancy, int sq);
 void execute_move(Position *p, Move move);
+void init_check_info(Position *p, CheckInfo *ci);
+// Whether the pseudo-legal move by the side to move checks the opponent.
+bool gives_check(Position *p, const CheckInfo *ci, Move move);
 GameOutcome position_outcome(Position *p);
 #endif // POSITION_H
\ No newline at end of file
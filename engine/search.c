@@ -1,170 +1,876 @@
 #include "search.h"
+#include "endgame.h"
 #include "eval.h"
+#include "evalcache.h"
+#include "tt.h"
 #include "zobrist.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-typedef enum { UPPER, LOWER, EXACT } BoundType;
+#define MATE (INF - 1)
+#define IS_MATE(score) (abs(score) >= MATE - MAX_PLY)
 
+SearchParams search_params = {
+    .futility_depth = 3,
+    .futility_margin = 110,
+    .rfp_depth = 6,
+    .rfp_margin = 90,
+    .razor_depth = 2,
+    .razor_margin = 250,
+};
+
+SearchStats search_stats;
+
+#ifdef GCE_SEARCH_STATS
+#define STAT_INC(t, counter) ((t)->stats.counter++)
+#else
+#define STAT_INC(t, counter) ((void)0)
+#endif
+
+// A root move with what the previous iterations learned about it. The subtree
+// size is the best predictor of how hard the move is to refute, so the root is
+// searched best move first and then by the nodes summed over all iterations,
+// which is less noisy than the last iteration alone.
 typedef struct {
-    uint64_t hash;
-    int depth;
-    int eval;
+    Move move;
+    uint64_t nodes; // in the last search of the root
+    uint64_t total_nodes;
+} RootMove;
+
+/**
+ * Everything a search thread owns. The transposition table is the only state
+ * shared between threads; ordering heuristics and counters are per thread so
+ * helpers don't contend on them.
+ */
+typedef struct {
+    int id;
+    pthread_t handle;
+    Position root;
+
+    Move killers[MAX_PLY][2];
+    int history[2][64][64];
+    SearchStats stats;
+    uint64_t nodes;
+    int seldepth;
+
+    // Kept across searches, pawn structures recur from one move to the next
+    PawnTable *pawns;
+    // Network accumulator of the position at each ply, if NNUE is enabled
+    Accumulator accumulators[MAX_PLY];
+
+    // Triangular PV table: pv[ply] holds the best line found from ply on
+    Move pv[MAX_PLY][MAX_PLY];
+    int pv_length[MAX_PLY];
+
+    RootMove root_moves[256];
+    int num_root_moves;
+
+    // Root moves already reported as an earlier MultiPV line
+    Move excluded[256];
+    int num_excluded;
+
     Move best_move;
-    BoundType bound_type;
-} TableEntry;
+    int best_eval;
+    int completed_depth;
+} SearchThread;
 
-const int TT_SIZE = 1 << 24; // 2^24 entries * 16 bytes = 256 MiB
-const int TT_MASK = TT_SIZE - 1;
+#define MAX_THREADS 256
 
-TableEntry *transposition_table = NULL;
+static SearchThread *threads = NULL;
+static int num_threads = 1;
+static int multi_pv = 1;
 
-bool init_tt() {
-    if (transposition_table != NULL) {
-        return true;
-    }
+// Set by stop_search() or when the main thread is done, and polled at every
+// node so all threads abandon their iteration.
+static int stop_flag = 0;
 
-    transposition_table = calloc(TT_SIZE, sizeof(TableEntry));
-    if (!transposition_table) {
+// Set by start_ponder() until ponderhit() or the end of the search.
+static int pondering = 0;
+static double ponderhit_time = 0;
+
+static inline bool should_stop() {
+    return __atomic_load_n(&stop_flag, __ATOMIC_RELAXED);
+}
+
+static inline bool is_pondering() {
+    return __atomic_load_n(&pondering, __ATOMIC_ACQUIRE);
+}
+
+void stop_search() { __atomic_store_n(&stop_flag, 1, __ATOMIC_RELAXED); }
+
+// Hard time limit of the current search, polled from inside search() by the
+// main thread. A limit of 0 means the search isn't timed.
+static double search_start = 0;
+static double hard_limit = 0;
+static bool ponder_search = false;
+
+// Node budget of the current search, counted on a shared counter so it holds
+// across threads. The limit stays at UINT64_MAX until the first iteration is
+// done, so even a budget of 0 returns a searched move.
+static bool limit_nodes = false;
+static uint64_t node_limit = UINT64_MAX;
+static uint64_t shared_nodes = 0;
+
+static SearchInfoCallback info_callback = NULL;
+
+void set_search_info_callback(SearchInfoCallback callback) {
+    info_callback = callback;
+}
+
+#define TIME_CHECK_INTERVAL 2048
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void check_time() {
+    if (hard_limit == 0 || is_pondering())
+        return;
+
+    // After a ponderhit the clock starts from there
+    double start = ponder_search ? fmax(search_start, ponderhit_time)
+                                 : search_start;
+    if (now() - start >= hard_limit)
+        stop_search();
+}
+
+// Counts a node, and has the main thread check the clock every few thousand.
+// The count is read by the main thread while helpers are still searching.
+static inline void count_node(SearchThread *t, int ply) {
+    uint64_t nodes = t->nodes + 1;
+    __atomic_store_n(&t->nodes, nodes, __ATOMIC_RELAXED);
+    t->pv_length[ply] = 0;
+    if (ply > t->seldepth)
+        t->seldepth = ply;
+
+    if (nodes % TIME_CHECK_INTERVAL == 0 && t->id == 0)
+        check_time();
+    if (limit_nodes &&
+        __atomic_add_fetch(&shared_nodes, 1, __ATOMIC_RELAXED) >=
+            __atomic_load_n(&node_limit, __ATOMIC_RELAXED))
+        stop_search();
+}
+
+bool set_search_threads(int count) {
+    if (count < 1)
+        count = 1;
+    if (count > MAX_THREADS)
+        count = MAX_THREADS;
+
+    SearchThread *new_threads = calloc(count, sizeof(SearchThread));
+    if (!new_threads) {
         return false;
     }
+    for (int i = 0; i < count; i++) {
+        new_threads[i].pawns = calloc(1, sizeof(PawnTable));
+        if (!new_threads[i].pawns) {
+            while (i--)
+                free(new_threads[i].pawns);
+            free(new_threads);
+            return false;
+        }
+    }
+
+    for (int i = 0; threads && i < num_threads; i++) {
+        free(threads[i].pawns);
+    }
+    free(threads);
+    threads = new_threads;
+    num_threads = count;
+    for (int i = 0; i < count; i++) {
+        threads[i].id = i;
+    }
 
     return true;
 }
 
-void free_tt() {
-    if (transposition_table != NULL) {
-        free(transposition_table);
-        transposition_table = NULL;
+int get_search_threads() { return num_threads; }
+
+void set_multi_pv(int count) { multi_pv = count < 1 ? 1 : count; }
+
+int get_multi_pv() { return multi_pv; }
+
+static bool is_excluded(SearchThread *t, Move move) {
+    for (int i = 0; i < t->num_excluded; i++) {
+        if (t->excluded[i] == move)
+            return true;
+    }
+
+    return false;
+}
+
+// Mate scores are stored relative to the node rather than the root so that
+// they stay valid when the same position is reached at a different ply.
+static int score_to_tt(int score, int ply) {
+    if (score >= MATE - MAX_PLY)
+        return score + ply;
+    if (score <= -MATE + MAX_PLY)
+        return score - ply;
+    return score;
+}
+
+static int score_from_tt(int score, int ply) {
+    if (score >= MATE - MAX_PLY)
+        return score - ply;
+    if (score <= -MATE + MAX_PLY)
+        return score + ply;
+    return score;
+}
+
+static inline int side_to_move(Position *pos) {
+    return pos->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+}
+
+static bool in_check(Position *pos) {
+    return king_attacked(pos, side_to_move(pos));
+}
+
+// eval_position() scores from white's perspective, negamax wants the side to
+// move. Callers that only compare the result to (alpha, beta) may get a lazy
+// estimate (see eval_position_lazy()), the others pass -INF, INF.
+static int evaluate(SearchThread *t, Position *pos, int ply, int alpha,
+                    int beta) {
+    bool black = side_to_move(pos) == PIECE_BLACK;
+    int eval;
+    STAT_INC(t, eval_probes);
+    if (eval_cache_probe(pos->hash, &eval)) {
+        STAT_INC(t, eval_hits);
+    } else if (nnue_enabled()) {
+        eval = eval_position_nnue(pos, &t->accumulators[ply]);
+        eval_cache_store(pos->hash, eval);
+    } else {
+        bool lazy;
+        eval = eval_position_lazy(pos, t->pawns, black ? -beta : alpha,
+                                  black ? -alpha : beta, &lazy);
+        // An estimate is only good for this window
+        if (lazy)
+            STAT_INC(t, lazy_evals);
+        else
+            eval_cache_store(pos->hash, eval);
     }
+    if (black)
+        eval = -eval;
+
+    return eval == -MATE ? -MATE + ply : eval;
+}
+
+// Derive the accumulator of child, the position after a move at ply.
+static inline void update_accumulator(SearchThread *t, Position *child,
+                                      int ply) {
+    if (nnue_enabled())
+        nnue_update(&t->accumulators[ply + 1], &t->accumulators[ply], child);
 }
 
-int search(Position *pos, int depth, int alpha, int beta, bool maximizing,
-           bool moving, Move *best_move) {
-    if (depth == 0) {
-        return eval_position(pos);
+// Returns the type of the piece on sq, or -1 if the square is empty.
+static int piece_on(Position *pos, int sq) {
+    uint64_t bb = 1ULL << sq;
+    for (int i = 0; i < MAX_PIECE; i++) {
+        if (pos->bitboards[i] & bb)
+            return PIECE_TYPE(i);
     }
 
-    uint64_t hash = position_zobrist(pos);
-    TableEntry *entry = &transposition_table[hash & TT_MASK];
-    if (entry->hash == hash && entry->depth >= depth) {
-        bool hit = entry->bound_type == EXACT ||
-                   (entry->bound_type == LOWER && entry->eval >= beta) ||
-                   (entry->bound_type == UPPER && entry->eval <= alpha);
+    return -1;
+}
+
+// Captures and promotions, i.e. the moves searched by quiesce().
+static bool is_tactical(Position *pos, Move move) {
+    if (MOVE_PROMO(move))
+        return true;
+
+    uint64_t to_bb = 1ULL << MOVE_TO(move);
+    if (GET_OCCUPIED(pos) & to_bb)
+        return true;
+
+    return (pos->en_passant & to_bb) &&
+           (pos->bitboards[side_to_move(pos) | PIECE_PAWN] &
+            (1ULL << MOVE_FROM(move)));
+}
+
+#define TT_MOVE_SCORE 1000000
+#define CAPTURE_SCORE 100000
+#define PROMO_SCORE 90000
+#define KILLER_SCORE 80000
+#define HISTORY_MAX 60000
 
-        if (hit) {
-            if (moving)
-                *best_move = entry->best_move;
-            return entry->eval;
+static void score_moves(SearchThread *t, Position *pos, int ply, Move *moves,
+                        int *scores, int count, Move tt_move) {
+    int color = side_to_move(pos) == PIECE_WHITE ? 0 : 1;
+    for (int i = 0; i < count; i++) {
+        Move move = moves[i];
+        if (move == tt_move) {
+            scores[i] = TT_MOVE_SCORE;
+            continue;
+        }
+
+        int victim = piece_on(pos, MOVE_TO(move));
+        if (victim != -1) {
+            // MVV-LVA: most valuable victim first, cheapest attacker first
+            int attacker = piece_on(pos, MOVE_FROM(move));
+            scores[i] = CAPTURE_SCORE + piece_values[victim] * 8 -
+                        (attacker == PIECE_KING ? 0 : piece_values[attacker]);
+        } else if (MOVE_PROMO(move)) {
+            scores[i] = PROMO_SCORE + MOVE_PROMO(move);
+        } else if (is_tactical(pos, move)) {
+            scores[i] = CAPTURE_SCORE; // en passant
+        } else if (move == t->killers[ply][0]) {
+            scores[i] = KILLER_SCORE;
+        } else if (move == t->killers[ply][1]) {
+            scores[i] = KILLER_SCORE - 1;
+        } else {
+            scores[i] = t->history[color][MOVE_FROM(move)][MOVE_TO(move)];
         }
     }
+}
+
+// Record a quiet move that caused a beta cut-off.
+static void update_quiet_stats(SearchThread *t, Position *pos, int ply,
+                               Move move, int depth) {
+    if (t->killers[ply][0] != move) {
+        t->killers[ply][1] = t->killers[ply][0];
+        t->killers[ply][0] = move;
+    }
+
+    int color = side_to_move(pos) == PIECE_WHITE ? 0 : 1;
+    int *entry = &t->history[color][MOVE_FROM(move)][MOVE_TO(move)];
+    *entry += depth * depth;
+    if (*entry > HISTORY_MAX) {
+        // Age the whole table so the scores stay below the killers
+        for (int c = 0; c < 2; c++)
+            for (int from = 0; from < 64; from++)
+                for (int to = 0; to < 64; to++)
+                    t->history[c][from][to] /= 2;
+    }
+}
+
+// Selection sort step: swap the best remaining move into slot i.
+static void pick_move(Move *moves, int *scores, int count, int i) {
+    int best = i;
+    for (int j = i + 1; j < count; j++) {
+        if (scores[j] > scores[best])
+            best = j;
+    }
+
+    Move move = moves[i];
+    moves[i] = moves[best];
+    moves[best] = move;
+
+    int score = scores[i];
+    scores[i] = scores[best];
+    scores[best] = score;
+}
+
+static int quiesce(SearchThread *t, Position *pos, int ply, int alpha,
+                   int beta) {
+    if (should_stop()) {
+        return 0;
+    }
+
+    count_node(t, ply);
+    STAT_INC(t, qnodes);
+    if (is_known_draw(pos)) {
+        STAT_INC(t, endgame_draws);
+        return 0;
+    }
+
+    int stand_pat = evaluate(t, pos, ply, alpha, beta);
+    if (stand_pat >= beta || ply >= MAX_PLY - 1 || IS_MATE(stand_pat))
+        return stand_pat;
+
+    if (stand_pat > alpha)
+        alpha = stand_pat;
 
     Move moves[256];
+    int scores[256];
     int num_moves = generate_moves(pos, moves);
-    int value;
-    Move best_move_buf = moves[0];
+    int count = 0;
+    for (int i = 0; i < num_moves; i++) {
+        if (is_tactical(pos, moves[i]))
+            moves[count++] = moves[i];
+    }
 
-    if (maximizing) {
-        value = -INF;
-        for (int i = 0; i < num_moves; i++) {
-            Position copy = *pos;
-            execute_move(&copy, moves[i]);
+    score_moves(t, pos, ply, moves, scores, count, 0);
+    int best = stand_pat;
+    for (int i = 0; i < count; i++) {
+        pick_move(moves, scores, count, i);
+        Position copy = *pos;
+        execute_move(&copy, moves[i]);
+        eval_cache_prefetch(copy.hash);
+        update_accumulator(t, &copy, ply);
+
+        int score = -quiesce(t, &copy, ply + 1, -beta, -alpha);
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta)
+                    break;
+            }
+        }
+    }
+
+    return best;
+}
+
+// An exact TT hit inside the window ends the PV at this node, so continue it
+// with the TT's best moves (at most depth of them, which also stops cycles).
+// Without this a warm TT leaves the reported PV one move long.
+static void pv_from_tt(SearchThread *t, Position *pos, int ply, int depth) {
+    Position copy = *pos;
+    int length = 0;
+    int max_length = depth < MAX_PLY - 1 - ply ? depth : MAX_PLY - 1 - ply;
+    TTEntry entry;
+    while (length < max_length && tt_probe(copy.hash, &entry) && entry.move) {
+        // The entry may belong to another position with the same key bits
+        Move moves[256];
+        int count = generate_moves(&copy, moves);
+        bool legal = false;
+        for (int i = 0; i < count && !legal; i++)
+            legal = moves[i] == entry.move;
+        if (!legal)
+            break;
+
+        t->pv[ply][length++] = entry.move;
+        execute_move(&copy, entry.move);
+    }
+
+    t->pv_length[ply] = length;
+}
+
+static int search(SearchThread *t, Position *pos, int depth, int ply,
+                  int alpha, int beta) {
+    if (should_stop()) {
+        return 0;
+    }
+
+    // Check extensions can keep depth from running out, the ply can't
+    if (depth <= 0 || ply >= MAX_PLY - 1) {
+        return quiesce(t, pos, ply, alpha, beta);
+    }
+
+    count_node(t, ply);
+    bool root = ply == 0;
+
+    // Mate distance pruning: even mating right here can't beat a shorter mate
+    // found elsewhere in the tree.
+    if (!root) {
+        alpha = alpha > -MATE + ply ? alpha : -MATE + ply;
+        beta = beta < MATE - ply - 1 ? beta : MATE - ply - 1;
+        if (alpha >= beta)
+            return alpha;
+
+        if (is_known_draw(pos)) {
+            STAT_INC(t, endgame_draws);
+            return 0;
+        }
+    }
+
+    int alpha_orig = alpha;
+    uint64_t hash = pos->hash;
+    TTEntry entry;
+    Move tt_move = 0;
+    STAT_INC(t, tt_probes);
+    if (tt_probe(hash, &entry)) {
+        STAT_INC(t, tt_hits);
+        tt_move = entry.move;
+        int eval = score_from_tt(entry.score, ply);
+        bool hit = entry.depth >= depth &&
+                   (entry.bound == BOUND_EXACT ||
+                    (entry.bound == BOUND_LOWER && eval >= beta) ||
+                    (entry.bound == BOUND_UPPER && eval <= alpha));
+
+        if (hit && !root) {
+            STAT_INC(t, tt_cutoffs);
+            if (eval > alpha && eval < beta)
+                pv_from_tt(t, pos, ply, depth);
+            return eval;
+        }
+    }
+
+    bool check = in_check(pos);
+    bool futile = false;
+    if (!root && !check) {
+        int static_eval = evaluate(t, pos, ply, -INF, INF);
 
-            int new_value =
-                search(&copy, depth - 1, alpha, beta, false, false, NULL);
+        // Reverse futility: the position is so good that even a generous
+        // margin per remaining ply keeps us above beta.
+        if (depth <= search_params.rfp_depth && !IS_MATE(beta) &&
+            static_eval - search_params.rfp_margin * depth >= beta) {
+            STAT_INC(t, rfp_prunes);
+            return static_eval;
+        }
 
-            if (new_value > value) {
-                value = new_value;
-                best_move_buf = moves[i];
+        // Razoring: hopelessly below alpha, so verify with a quiescence
+        // search instead of expanding every move.
+        if (depth <= search_params.razor_depth &&
+            static_eval + search_params.razor_margin * depth < alpha) {
+            int score = quiesce(t, pos, ply, alpha - 1, alpha);
+            if (score < alpha) {
+                STAT_INC(t, razor_prunes);
+                return score;
             }
+        }
+
+        // Futility: quiet moves cannot raise the score back up to alpha.
+        futile = depth <= search_params.futility_depth && !IS_MATE(alpha) &&
+                 static_eval + search_params.futility_margin * depth <= alpha;
+    }
 
-            if (new_value > alpha)
-                alpha = new_value;
-            if (alpha >= beta)
-                break; // Beta cut-off
+    Move moves[256];
+    int scores[256];
+    int num_moves;
+    if (root) {
+        // Already ordered by the previous iteration
+        num_moves = t->num_root_moves;
+        for (int i = 0; i < num_moves; i++) {
+            moves[i] = t->root_moves[i].move;
+            scores[i] = num_moves - i;
         }
     } else {
-        value = INF;
-        for (int i = 0; i < num_moves; i++) {
-            Position copy = *pos;
-            execute_move(&copy, moves[i]);
+        num_moves = generate_moves(pos, moves);
+        score_moves(t, pos, ply, moves, scores, num_moves, tt_move);
+    }
 
-            int new_value =
-                search(&copy, depth - 1, alpha, beta, true, false, NULL);
+    if (num_moves == 0) {
+        return check ? -MATE + ply : 0;
+    }
 
-            if (new_value < value) {
-                value = new_value;
-                best_move_buf = moves[i];
-            }
+    CheckInfo ci;
+    init_check_info(pos, &ci);
+    int value = -INF;
+    int searched = 0;
+    Move best_move_buf = moves[0];
+    for (int i = 0; i < num_moves; i++) {
+        pick_move(moves, scores, num_moves, i);
+        Move move = moves[i];
+        if (root && is_excluded(t, move))
+            continue;
+        // Checks are never pruned and get searched one ply deeper
+        bool checks = gives_check(pos, &ci, move);
+        if (futile && searched > 0 && !checks && !is_tactical(pos, move)) {
+            STAT_INC(t, futility_prunes);
+            continue;
+        }
 
-            if (new_value < beta)
-                beta = new_value;
-            if (beta <= alpha)
+        Position copy = *pos;
+        execute_move(&copy, move);
+        tt_prefetch(copy.hash);
+        eval_cache_prefetch(copy.hash);
+        update_accumulator(t, &copy, ply);
+
+        uint64_t nodes_before = t->nodes;
+        int new_depth = checks ? depth : depth - 1;
+        int new_value = -search(t, &copy, new_depth, ply + 1, -beta, -alpha);
+        searched++;
+        if (root) {
+            t->root_moves[i].nodes = t->nodes - nodes_before;
+            t->root_moves[i].total_nodes += t->nodes - nodes_before;
+        }
+
+        if (new_value > value) {
+            value = new_value;
+            best_move_buf = move;
+        }
+
+        if (new_value > alpha) {
+            alpha = new_value;
+            t->pv[ply][0] = move;
+            memcpy(&t->pv[ply][1], t->pv[ply + 1],
+                   t->pv_length[ply + 1] * sizeof(Move));
+            t->pv_length[ply] = t->pv_length[ply + 1] + 1;
+        }
+        if (alpha >= beta) {
+            STAT_INC(t, beta_cutoffs);
+            if (searched == 1)
+                STAT_INC(t, first_move_cutoffs);
+            if (!is_tactical(pos, move))
+                update_quiet_stats(t, pos, ply, move, depth);
+            break; // Beta cut-off
+        }
+    }
+
+    // An aborted search returns garbage, don't let it reach the TT or root.
+    if (should_stop()) {
+        return 0;
+    }
+
+    if (root) {
+        t->best_move = best_move_buf;
+        // The score of a partial root move list doesn't belong in the TT
+        if (t->num_excluded > 0)
+            return value;
+    }
+
+    BoundType bound = value <= alpha_orig ? BOUND_UPPER
+                      : value >= beta     ? BOUND_LOWER
+                                          : BOUND_EXACT;
+    // A fail-low node has no meaningful best move
+    tt_store(hash, depth, score_to_tt(value, ply), bound,
+             bound == BOUND_UPPER ? 0 : best_move_buf);
+
+    return value;
+}
+
+void start_ponder() { __atomic_store_n(&pondering, 1, __ATOMIC_RELEASE); }
+
+void ponderhit() {
+    ponderhit_time = now();
+    // release: the search must see ponderhit_time once pondering reads 0
+    __atomic_store_n(&pondering, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Order the root moves for the next iteration: first the given moves (the
+ * best move, or one per MultiPV line), then the rest by the number of nodes
+ * their subtrees took so far.
+ */
+static void sort_root_moves(SearchThread *t, const Move *first, int count) {
+    RootMove *moves = t->root_moves;
+    int sorted = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = sorted; j < t->num_root_moves; j++) {
+            if (moves[j].move == first[i]) {
+                RootMove tmp = moves[j];
+                memmove(&moves[sorted + 1], &moves[sorted],
+                        (j - sorted) * sizeof(RootMove));
+                moves[sorted++] = tmp;
                 break;
+            }
         }
     }
 
-    if (moving) {
-        *best_move = best_move_buf;
+    // Insertion sort, the order barely changes between iterations
+    for (int i = sorted + 1; i < t->num_root_moves; i++) {
+        RootMove tmp = moves[i];
+        int j = i;
+        while (j > sorted && moves[j - 1].total_nodes < tmp.total_nodes) {
+            moves[j] = moves[j - 1];
+            j--;
+        }
+        moves[j] = tmp;
     }
+}
 
-    entry->hash = hash;
-    entry->depth = depth;
-    entry->eval = value;
-    entry->best_move = best_move_buf;
+// The first iteration has no node counts yet, so start with the usual move
+// ordering.
+static void init_root_moves(SearchThread *t, Position *pos) {
+    Move moves[256];
+    int scores[256];
+    int count = generate_moves(pos, moves);
+    TTEntry entry;
+    Move tt_move = tt_probe(pos->hash, &entry) ? entry.move : 0;
+    score_moves(t, pos, 0, moves, scores, count, tt_move);
 
-    if (value <= alpha) {
-        entry->bound_type = UPPER;
-    } else if (value >= beta) {
-        entry->bound_type = LOWER;
-    } else {
-        entry->bound_type = EXACT;
+    t->num_root_moves = count;
+    for (int i = 0; i < count; i++) {
+        pick_move(moves, scores, count, i);
+        t->root_moves[i] = (RootMove){moves[i], 0, 0};
     }
+}
 
-    return value;
+// Share of the root's nodes spent on move in the last search of the root.
+static double root_move_effort(SearchThread *t, Move move, uint64_t nodes) {
+    for (int i = 0; i < t->num_root_moves; i++) {
+        if (t->root_moves[i].move == move)
+            return nodes ? (double)t->root_moves[i].nodes / nodes : 0;
+    }
+
+    return 0;
+}
+
+static void reset_thread(SearchThread *t, Position *pos) {
+    t->root = *pos;
+    memset(t->killers, 0, sizeof(t->killers));
+    memset(t->history, 0, sizeof(t->history));
+    t->stats = (SearchStats){0};
+    t->pawns->probes = 0;
+    t->pawns->hits = 0;
+    t->nodes = 0;
+    t->seldepth = 0;
+    t->pv_length[0] = 0;
+    t->num_excluded = 0;
+    t->best_move = 0;
+    t->best_eval = 0;
+    t->completed_depth = 0;
+    if (nnue_enabled())
+        nnue_refresh(&t->accumulators[0], pos);
+    init_root_moves(t, pos);
+}
+
+// Lazy SMP depth staggering: helper i skips the depths where
+// ((depth + phase) / size) is odd, so the helpers spread over adjacent depths
+// and fill the shared TT ahead of the main thread.
+static const int skip_size[20] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int skip_phase[20] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3,
+                                   4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+static void *helper_main(void *arg) {
+    SearchThread *t = arg;
+    int i = (t->id - 1) % 20;
+    for (int depth = 1; depth < MAX_PLY && !should_stop(); depth++) {
+        if (((depth + skip_phase[i]) / skip_size[i]) % 2)
+            continue;
+
+        int eval = search(t, &t->root, depth, 0, -INF, INF);
+        if (!should_stop()) {
+            t->best_eval = eval;
+            t->completed_depth = depth;
+            sort_root_moves(t, &t->best_move, 1);
+        }
+    }
+
+    return NULL;
+}
+
+// Returns false if the thread state couldn't be allocated.
+static bool start_helpers(Position *pos) {
+    if (!threads && !set_search_threads(num_threads)) {
+        return false;
+    }
+
+    init_eval_cache();
+    init_endgames();
+    tt_new_search();
+    __atomic_store_n(&stop_flag, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < num_threads; i++) {
+        reset_thread(&threads[i], pos);
+    }
+
+    for (int i = 1; i < num_threads; i++) {
+        // If the platform has no threads (e.g. the web build) the main thread
+        // simply searches alone.
+        if (pthread_create(&threads[i].handle, NULL, helper_main,
+                           &threads[i]) != 0) {
+            threads[i].id = -1;
+        }
+    }
+
+    return true;
+}
+
+static void stop_helpers() {
+    __atomic_store_n(&stop_flag, 1, __ATOMIC_RELAXED);
+    search_stats = (SearchStats){0};
+    for (int i = 0; i < num_threads; i++) {
+        if (i > 0 && threads[i].id != -1) {
+            pthread_join(threads[i].handle, NULL);
+        }
+        threads[i].id = i;
+
+        SearchStats *stats = &threads[i].stats;
+        search_stats.nodes += threads[i].nodes;
+        search_stats.qnodes += stats->qnodes;
+        search_stats.tt_probes += stats->tt_probes;
+        search_stats.tt_hits += stats->tt_hits;
+        search_stats.tt_cutoffs += stats->tt_cutoffs;
+        search_stats.beta_cutoffs += stats->beta_cutoffs;
+        search_stats.first_move_cutoffs += stats->first_move_cutoffs;
+        search_stats.futility_prunes += stats->futility_prunes;
+        search_stats.rfp_prunes += stats->rfp_prunes;
+        search_stats.razor_prunes += stats->razor_prunes;
+        search_stats.endgame_draws += stats->endgame_draws;
+        search_stats.eval_probes += stats->eval_probes;
+        search_stats.eval_hits += stats->eval_hits;
+        search_stats.lazy_evals += stats->lazy_evals;
+        search_stats.pawn_probes += threads[i].pawns->probes;
+        search_stats.pawn_hits += threads[i].pawns->hits;
+    }
+
+    __atomic_store_n(&stop_flag, 0, __ATOMIC_RELAXED);
 }
 
 Move get_best_move(Position *pos, int depth) {
-    Move best_move = 0;
-    search(pos, depth, -INF, INF, pos->moves % 2 == 0, true, &best_move);
-    return best_move;
+    if (!start_helpers(pos)) {
+        return 0;
+    }
+    SearchThread *main_thread = &threads[0];
+    search(main_thread, pos, depth, 0, -INF, INF);
+    stop_helpers();
+    return main_thread->best_move;
 }
 
-double now() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+// Nodes searched so far, summed over all threads.
+static uint64_t total_nodes() {
+    uint64_t nodes = 0;
+    for (int i = 0; i < num_threads; i++)
+        nodes += __atomic_load_n(&threads[i].nodes, __ATOMIC_RELAXED);
+    return nodes;
 }
 
-#define MAX_USAGE 0.4f
-#define SAFEGUARD 200.0f
+// Fills the line-specific part of info from the search of one MultiPV line.
+static void fill_info(SearchThread *t, int depth, int eval, SearchInfo *info) {
+    info->depth = depth;
+    info->seldepth = t->seldepth;
+    info->score = eval;
+    info->mate = 0;
+    if (IS_MATE(eval))
+        info->mate = eval > 0 ? (MATE - eval + 1) / 2 : -(MATE + eval) / 2;
 
-void get_best_move_ex(Position *pos, float time_available, float increment,
-                      int moves_to_go, int depth, float move_time,
-                      Move *result_move, int *result_depth, int *result_eval) {
-    bool maximizing = pos->moves % 2 == 0;
+    info->pv_length = t->pv_length[0];
+    memcpy(info->pv, t->pv[0], info->pv_length * sizeof(Move));
+    if (info->pv_length == 0) {
+        info->pv[0] = t->best_move;
+        info->pv_length = 1;
+    }
+}
 
-    if (depth != -1) {
-        *result_eval =
-            search(pos, depth, -INF, INF, maximizing, true, result_move);
-        *result_depth = depth;
-        return;
+// A MultiPV line of the current iteration. The lines are collected and
+// reported together once the iteration is done, best first.
+typedef struct {
+    Move move;
+    int eval;
+    SearchInfo info;
+} Line;
+
+static Line lines_found[256];
+
+// Insertion sort by score, stable so equal lines keep the search order.
+static void sort_lines(Line *lines, int count) {
+    for (int i = 1; i < count; i++) {
+        Line tmp = lines[i];
+        int j = i;
+        while (j > 0 && lines[j - 1].eval < tmp.eval) {
+            lines[j] = lines[j - 1];
+            j--;
+        }
+        lines[j] = tmp;
     }
+}
 
-    double target_ms;
+#define MAX_USAGE 0.4f
+#define SAFEGUARD 200.0f
+
+#define HARD_RATIO 4.0
+
+/**
+ * Computes the time budget in seconds. The soft limit is the time we'd like to
+ * use: no new iteration is started once it's about to run out. The hard limit
+ * aborts an iteration in progress, so one that blows up can't flag.
+ */
+static void time_limits(float time_available, float increment,
+                        int moves_to_go, float move_time, double *soft,
+                        double *hard) {
+    double target_ms, hard_ms;
     if (move_time != -1) {
-        target_ms = move_time * 1000;
+        target_ms = move_time;
+        hard_ms = move_time;
     } else {
         // Emergency time handling
         if (time_available < 500.0f) {
             target_ms = 50.0f;
+            hard_ms = fmax(fmin(100.0f, time_available * 0.5f), 10.0f);
         } else {
             double base_time = time_available - SAFEGUARD;
             if (base_time <= 0) {
                 target_ms = increment * MAX_USAGE;
+                hard_ms = increment * 0.8f;
             } else {
                 if (moves_to_go <= 0) {
                     moves_to_go = 25;
@@ -177,36 +883,161 @@ void get_best_move_ex(Position *pos, float time_available, float increment,
                 // Ensure minimum and maximum bounds
                 target_ms = fmax(target_ms, 50.0f);
                 target_ms = fmin(target_ms, base_time * 0.4f);
+
+                hard_ms = fmin(target_ms * HARD_RATIO, base_time * 0.6f);
+                hard_ms = fmax(hard_ms, target_ms);
             }
         }
     }
 
-    double target = target_ms / 1000.0;
-    const double start = now();
-    int curr_eval = 0;
-    Move best_move;
+    // A hard limit of 0 would mean no limit at all to check_time(), which is
+    // the last thing a nearly empty clock (or `go movetime 0`) needs
+    hard_ms = fmax(hard_ms, 10.0f);
 
-    *result_eval = search(pos, 1, -INF, INF, maximizing, true, result_move);
-    *result_depth = 1;
-    int curr_depth = 2;
-    while (now() - start < (target * 0.9)) {
-        // todo: break on mate or 1 legal move
+    *soft = target_ms / 1000.0;
+    *hard = hard_ms / 1000.0;
+}
+
+void get_best_move_ex(Position *pos, float time_available, float increment,
+                      int moves_to_go, int depth, float move_time,
+                      int64_t nodes, bool ponder, Move *result_move,
+                      int *result_depth, int *result_eval) {
+    bool infinite = time_available == -1 && depth == -1 && move_time == -1 &&
+                    nodes == -1;
+    bool timed = depth == -1 && (time_available != -1 || move_time != -1);
+    int max_depth = depth != -1 ? depth : MAX_PLY - 1;
+    double soft = 0, hard = 0;
+    if (timed) {
+        time_limits(time_available, increment, moves_to_go, move_time, &soft,
+                    &hard);
+    }
+    double start = now();
+
+    search_start = start;
+    hard_limit = hard;
+    ponder_search = ponder;
+    limit_nodes = nodes >= 0;
+    node_limit = UINT64_MAX;
+    shared_nodes = 0;
+    *result_move = 0;
+    *result_eval = 0;
+    *result_depth = 0;
+    if (!start_helpers(pos)) {
+        hard_limit = 0;
+        limit_nodes = false;
+        __atomic_store_n(&pondering, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    SearchThread *main_thread = &threads[0];
+
+    int legal_moves = main_thread->num_root_moves;
+    int lines = legal_moves < multi_pv ? legal_moves : multi_pv;
+
+    // With a single legal move there is nothing to think about, a depth 1
+    // search is enough for a score.
+    if (timed && legal_moves == 1)
+        max_depth = 1;
+
+    for (int curr_depth = 1; curr_depth <= max_depth; curr_depth++) {
         double time_before = now();
-        curr_eval =
-            search(pos, curr_depth, -INF, INF, maximizing, true, &best_move);
+        uint64_t nodes_before = main_thread->nodes;
+        int curr_eval = 0;
+        double best_move_effort = 0;
+        int completed = 0;
+        main_thread->num_excluded = 0;
+        for (int line = 0; line < lines; line++) {
+            int eval = search(main_thread, pos, curr_depth, 0, -INF, INF);
+            if (should_stop())
+                break;
+
+            if (line == 0) {
+                best_move_effort =
+                    root_move_effort(main_thread, main_thread->best_move,
+                                     main_thread->nodes - nodes_before);
+            }
+
+            Line *found = &lines_found[completed++];
+            found->move = main_thread->best_move;
+            found->eval = eval;
+            if (info_callback)
+                fill_info(main_thread, curr_depth, eval, &found->info);
+            main_thread->excluded[main_thread->num_excluded++] =
+                main_thread->best_move;
+        }
+
+        // Each line is searched from scratch without the previous lines'
+        // moves, so a later line can come out ahead of line 1. GUIs take
+        // multipv 1 as the best line, so report and play them sorted.
+        sort_lines(lines_found, completed);
+        for (int i = 0; i < completed; i++) {
+            main_thread->excluded[i] = lines_found[i].move;
+            if (info_callback) {
+                SearchInfo *info = &lines_found[i].info;
+                double elapsed = now() - search_start;
+                info->multipv = i + 1;
+                info->nodes = total_nodes();
+                info->time_ms = (int)(elapsed * 1000);
+                info->nps = elapsed > 0 ? (uint64_t)(info->nodes / elapsed) : 0;
+                info->hashfull = tt_hashfull();
+                info_callback(info);
+            }
+        }
+
+        // Keep the last completed iteration, or at least its first lines
+        if (completed > 0) {
+            curr_eval = lines_found[0].eval;
+            *result_depth = curr_depth;
+            *result_eval = curr_eval;
+            *result_move = lines_found[0].move;
+        }
+        if (should_stop()) {
+            break;
+        }
+        if (limit_nodes && curr_depth == 1) {
+            __atomic_store_n(&node_limit, (uint64_t)nodes, __ATOMIC_RELAXED);
+            if (__atomic_load_n(&shared_nodes, __ATOMIC_RELAXED) >=
+                (uint64_t)nodes)
+                break;
+        }
+        sort_root_moves(main_thread, main_thread->excluded,
+                        main_thread->num_excluded);
+
         double search_time = now() - time_before;
 
-        if (abs(curr_eval) >= 50000) {
+        // A mate within the nominal depth is proven, deeper iterations can't
+        // find a shorter one.
+        if (IS_MATE(curr_eval) && MATE - abs(curr_eval) <= curr_depth) {
             break;
         }
 
-        if ((now() - start) + (search_time * 2) >= target * 0.8)
+        // While pondering the clock isn't ours yet, it starts at ponderhit
+        if (!timed || (ponder && is_pondering()))
+            continue;
+        if (ponder)
+            start = fmax(start, ponderhit_time);
+
+        // When the best move took most of the effort the alternatives were
+        // refuted quickly and it's unlikely to change, so stop sooner; when
+        // it's contested, allow some more time.
+        double scale = fmin(fmax(1.3 - best_move_effort, 0.6), 1.2);
+        if ((now() - start) + (search_time * 2) >= soft * 0.8 * scale)
             break;
+    }
 
-        curr_depth++;
+    // Infinite and pondering searches must not return before the GUI says so
+    while ((infinite || is_pondering()) && !should_stop()) {
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
     }
 
-    *result_depth = curr_depth - 1;
-    *result_eval = curr_eval;
-    *result_move = best_move;
-}
\ No newline at end of file
+    stop_helpers();
+    __atomic_store_n(&pondering, 0, __ATOMIC_RELAXED);
+    hard_limit = 0;
+    limit_nodes = false;
+    node_limit = UINT64_MAX;
+
+    // Stopped before the first iteration completed, any legal move will do
+    if (*result_move == 0 && main_thread->num_root_moves > 0) {
+        *result_move = main_thread->root_moves[0].move;
+    }
+}
@@ -3,11 +3,112 @@
 #include "position.h"
 #include <stdbool.h>
 
-bool init_tt();
-void free_tt();
+#define MAX_PLY 128
+
+/**
+ * Margins for the pruning applied near the leaves. Each margin is in
+ * centipawns per ply of remaining depth, and each heuristic only applies up to
+ * its *_depth. They are exposed so they can be tuned without recompiling.
+ *
+ * futility: skip quiet moves when static eval + margin can't reach alpha.
+ *
+ * rfp (reverse futility/static null move): return early when static eval -
+ * margin is still above beta.
+ *
+ * razor: drop into quiescence search when static eval + margin is below alpha.
+ */
+typedef struct {
+    int futility_depth;
+    int futility_margin;
+    int rfp_depth;
+    int rfp_margin;
+    int razor_depth;
+    int razor_margin;
+} SearchParams;
+
+extern SearchParams search_params;
+
+/**
+ * Counters for the last search, summed over all threads. Everything except
+ * nodes is only counted when gce-core is built with GCE_SEARCH_STATS (CMake
+ * option ENABLE_SEARCH_STATS) and stays 0 otherwise.
+ *
+ * nodes counts every node including quiescence nodes, qnodes only the latter.
+ * first_move_cutoffs / beta_cutoffs is a measure of move ordering quality.
+ * endgame_draws counts nodes scored 0 by is_known_draw().
+ * eval_hits / eval_probes and pawn_hits / pawn_probes are the hit rates of the
+ * eval cache and the pawn hash tables. lazy_evals counts quiescence stand-pat
+ * evaluations that stopped after the cheap terms (see eval_position_lazy()).
+ */
+typedef struct {
+    uint64_t nodes;
+    uint64_t qnodes;
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    uint64_t tt_cutoffs;
+    uint64_t beta_cutoffs;
+    uint64_t first_move_cutoffs;
+    uint64_t futility_prunes;
+    uint64_t rfp_prunes;
+    uint64_t razor_prunes;
+    uint64_t endgame_draws;
+    uint64_t eval_probes;
+    uint64_t eval_hits;
+    uint64_t lazy_evals;
+    uint64_t pawn_probes;
+    uint64_t pawn_hits;
+} SearchStats;
+
+extern SearchStats search_stats;
+
+/**
+ * Set the number of threads used for searching (Lazy SMP). All threads search
+ * the same root and share the transposition table; helpers start at staggered
+ * depths and only the main thread's result is reported. Returns false if the
+ * thread data could not be allocated, in which case the old count is kept.
+ */
+bool set_search_threads(int count);
+int get_search_threads();
+
+/**
+ * Set the number of best lines get_best_move_ex() reports (MultiPV). Each
+ * iteration searches the root once per line, excluding the moves of the lines
+ * found before it, so line i is the best move that isn't in lines 1..i-1.
+ */
+void set_multi_pv(int count);
+int get_multi_pv();
 
 Move get_best_move(Position *pos, int depth);
 
+/**
+ * Progress of the search after a completed iteration, reported once per line
+ * with multipv counting from 1. The score is from the side to move's
+ * perspective; mate is the number of moves until mate (negative when getting
+ * mated), or 0 if the score isn't a mate score. Nodes are summed over all
+ * threads.
+ */
+typedef struct {
+    int multipv;
+    int depth;
+    int seldepth;
+    int score;
+    int mate;
+    uint64_t nodes;
+    uint64_t nps;
+    int time_ms;
+    int hashfull;
+    int pv_length;
+    Move pv[MAX_PLY];
+} SearchInfo;
+
+typedef void (*SearchInfoCallback)(const SearchInfo *info);
+
+/**
+ * Register a function called by get_best_move_ex() after every completed
+ * iteration, on the thread running the search. Pass NULL to disable it.
+ */
+void set_search_info_callback(SearchInfoCallback callback);
+
 /**
  * Search for the best move using iterative deepening within the provided
  * restrictions. Each parameter corresponds to a UCI-standard argument. Provide
@@ -24,10 +125,45 @@ Move get_best_move(Position *pos, int depth);
  *
  * move_time: search for exactly x ms, corresponds to UCI movetime.
  *
- * Exclude a parameter using the value -1.
- * todo: support ponder, stop
+ * nodes: stop after x nodes summed over all threads, corresponds to UCI nodes.
+ * The first iteration is always completed, so a small or 0 budget still
+ * returns a searched move and can run over by that iteration's nodes. With a
+ * single thread the result only depends on the position and the hash table
+ * contents, not on machine load.
+ *
+ * ponder: search on the opponent's time, corresponds to UCI ponder. Call
+ * start_ponder() first. The clock is ignored until ponderhit() is called, and
+ * the function doesn't return before ponderhit() or stop_search().
+ *
+ * Exclude a parameter using the value -1. If time_available, depth, move_time
+ * and nodes are all excluded the search is infinite and only returns after
+ * stop_search().
+ *
+ * result_move is 0 if there is no legal move, or right away if the search
+ * threads' state couldn't be allocated.
  */
 void get_best_move_ex(Position *pos, float time_available, float increment,
                       int moves_to_go, int depth, float move_time,
-                      Move *result_move, int *result_depth, int *result_eval);
+                      int64_t nodes, bool ponder, Move *result_move,
+                      int *result_depth, int *result_eval);
+
+/**
+ * Ask the running search to stop as soon as possible. It is safe to call from
+ * another thread; get_best_move_ex() then returns the result of the last
+ * completed iteration. A request made before the search starts is ignored.
+ */
+void stop_search();
+
+/**
+ * Enter the pondering state for the next get_best_move_ex() with ponder set.
+ * Call it before handing that search to another thread, so a ponderhit() that
+ * arrives before the search gets going still counts.
+ */
+void start_ponder();
+
+// The opponent played the pondered move: start the clock for the search.
+void ponderhit();
+
+// Monotonic clock in seconds, used for the search's time limits.
+double now();
 #endif // SEARCH_H
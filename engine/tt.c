@@ -0,0 +1,295 @@
+#include "tt.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define BUCKET_SIZE 8
+#define CACHE_LINE 64
+#define HUGE_PAGE (2 * 1024 * 1024)
+
+typedef struct {
+    uint64_t entries[BUCKET_SIZE];
+} Bucket;
+
+static void *tt_memory = NULL;
+static size_t tt_mapped = 0; // size of the mapping if mmap was used
+static Bucket *buckets = NULL;
+static uint64_t num_buckets = 0;
+static uint8_t generation = 0;
+
+#define DATA_MASK 0xFFFFFFFFFFFFULL
+
+static inline uint64_t fold16(uint64_t data) {
+    return (data ^ (data >> 16) ^ (data >> 32)) & 0xFFFF;
+}
+
+static inline uint64_t pack(uint64_t hash, int depth, int score,
+                            BoundType bound, Move move) {
+    uint64_t data = (uint64_t)move | ((uint64_t)(uint16_t)score << 16) |
+                    ((uint64_t)(uint8_t)depth << 32) |
+                    ((uint64_t)bound << 40) | ((uint64_t)generation << 42);
+    return data | (((hash >> 48) ^ fold16(data)) << 48);
+}
+
+// Returns the key check stored in word, or an impossible value if the word was
+// torn.
+static inline uint64_t word_key(uint64_t word) {
+    return (word >> 48) ^ fold16(word & DATA_MASK);
+}
+
+#define WORD_MOVE(w) ((Move)((w) & 0xFFFF))
+#define WORD_SCORE(w) ((int)(int16_t)(((w) >> 16) & 0xFFFF))
+#define WORD_DEPTH(w) ((int)(((w) >> 32) & 0xFF))
+#define WORD_BOUND(w) ((BoundType)(((w) >> 40) & 3))
+#define WORD_GEN(w) ((int)(((w) >> 42) & 63))
+
+bool init_tt() {
+    if (buckets != NULL) {
+        return true;
+    }
+
+    return resize_tt(TT_DEFAULT_MB, 1);
+}
+
+void free_tt() {
+    if (tt_memory != NULL) {
+#ifdef __linux__
+        if (tt_mapped) {
+            munmap(tt_memory, tt_mapped);
+            tt_mapped = 0;
+        } else {
+            free(tt_memory);
+        }
+#else
+        free(tt_memory);
+#endif
+        tt_memory = NULL;
+        buckets = NULL;
+        num_buckets = 0;
+    }
+}
+
+#ifdef __linux__
+/**
+ * Probes hit random buckets, so with 4 KiB pages nearly every probe of a large
+ * table also misses the TLB. Try explicitly reserved huge pages first, then
+ * ask for transparent huge pages on a 2 MiB aligned mapping.
+ */
+static void *map_huge_pages(size_t size) {
+    size = (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+    void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    tt_mapped = size;
+    return mem;
+}
+#endif
+
+static bool allocate_tt(uint64_t count) {
+    // Over-allocate so the buckets can be aligned to a cache line; malloc only
+    // guarantees 16 bytes and aligned_alloc isn't available everywhere.
+    size_t size = count * sizeof(Bucket) + CACHE_LINE;
+    if ((size - CACHE_LINE) / sizeof(Bucket) != count) {
+        return false; // overflow on 32-bit targets
+    }
+
+#ifdef __linux__
+    // Below one huge page the TLB isn't the bottleneck
+    if (size >= HUGE_PAGE) {
+        tt_memory = map_huge_pages(size);
+    }
+    if (!tt_memory)
+#endif
+        tt_memory = malloc(size);
+    if (!tt_memory) {
+        return false;
+    }
+
+    uintptr_t aligned = ((uintptr_t)tt_memory + CACHE_LINE - 1) &
+                        ~(uintptr_t)(CACHE_LINE - 1);
+    buckets = (Bucket *)aligned;
+    num_buckets = count;
+    return true;
+}
+
+bool resize_tt(size_t mb, int threads) {
+    if (mb < 1)
+        mb = 1;
+
+    free_tt();
+    bool ok = allocate_tt((uint64_t)mb * 1024 * 1024 / sizeof(Bucket));
+    if (!ok && !allocate_tt((uint64_t)TT_DEFAULT_MB * 1024 * 1024 /
+                            sizeof(Bucket))) {
+        return false;
+    }
+
+    clear_tt(threads);
+    return ok;
+}
+
+typedef struct {
+    pthread_t handle;
+    bool started;
+    uint64_t start, count;
+} ClearJob;
+
+static void *clear_range(void *arg) {
+    ClearJob *job = arg;
+    memset(&buckets[job->start], 0, job->count * sizeof(Bucket));
+    return NULL;
+}
+
+void clear_tt(int threads) {
+    if (!buckets) {
+        return;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > 256)
+        threads = 256;
+
+    // Zeroing several GiB takes seconds on one core, so split it up. Each
+    // thread also first-touches its part, which spreads pages across NUMA
+    // nodes.
+    ClearJob jobs[256];
+    uint64_t chunk = num_buckets / threads;
+    for (int i = 0; i < threads; i++) {
+        jobs[i].start = chunk * i;
+        jobs[i].count = i == threads - 1 ? num_buckets - jobs[i].start : chunk;
+        jobs[i].started = i > 0 && pthread_create(&jobs[i].handle, NULL,
+                                                  clear_range, &jobs[i]) == 0;
+        if (!jobs[i].started)
+            clear_range(&jobs[i]);
+    }
+
+    for (int i = 1; i < threads; i++) {
+        if (jobs[i].started)
+            pthread_join(jobs[i].handle, NULL);
+    }
+
+    generation = 0;
+}
+
+void tt_new_search() { generation = (generation + 1) & 63; }
+
+// Maps the low 32 bits of the hash onto [0, num_buckets) with a multiply
+// instead of a mask, so the table doesn't have to be a power of two. The key
+// check uses the top bits, which are independent of the index.
+static inline Bucket *get_bucket(uint64_t hash) {
+    return &buckets[((hash & 0xFFFFFFFF) * num_buckets) >> 32];
+}
+
+void tt_prefetch(uint64_t hash) {
+    if (num_buckets)
+        __builtin_prefetch(get_bucket(hash));
+}
+
+static inline uint64_t load_word(uint64_t *slot) {
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+static inline void store_word(uint64_t *slot, uint64_t word) {
+    __atomic_store_n(slot, word, __ATOMIC_RELAXED);
+}
+
+int tt_hashfull() {
+    // Sample the first 125 buckets for entries written by the current search.
+    // Helper threads may be storing into them, so read like a probe.
+    int count = 0;
+    uint64_t sample = num_buckets < 125 ? num_buckets : 125;
+    for (uint64_t i = 0; i < sample; i++) {
+        for (int j = 0; j < BUCKET_SIZE; j++) {
+            uint64_t word = load_word(&buckets[i].entries[j]);
+            if (WORD_BOUND(word) != BOUND_NONE && WORD_GEN(word) == generation)
+                count++;
+        }
+    }
+
+    return sample ? (int)(count * 1000 / (sample * BUCKET_SIZE)) : 0;
+}
+
+bool tt_probe(uint64_t hash, TTEntry *entry) {
+    if (!num_buckets)
+        return false;
+
+    Bucket *bucket = get_bucket(hash);
+    uint64_t key = hash >> 48;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        uint64_t word = load_word(&bucket->entries[i]);
+        if (WORD_BOUND(word) != BOUND_NONE && word_key(word) == key) {
+            entry->move = WORD_MOVE(word);
+            entry->score = WORD_SCORE(word);
+            entry->depth = WORD_DEPTH(word);
+            entry->bound = WORD_BOUND(word);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Replacement policy: an entry for the same position is overwritten unless it
+ * is from the current search and considerably deeper. Otherwise the entry with
+ * the lowest depth is replaced, where every generation of age costs 8 plies so
+ * stale entries from earlier searches are evicted first.
+ */
+void tt_store(uint64_t hash, int depth, int score, BoundType bound,
+              Move move) {
+    if (!num_buckets)
+        return;
+
+    Bucket *bucket = get_bucket(hash);
+    uint64_t key = hash >> 48;
+    uint64_t *victim = NULL;
+    int victim_value = 1 << 30;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        uint64_t *slot = &bucket->entries[i];
+        uint64_t word = load_word(slot);
+        int value;
+        if (WORD_BOUND(word) == BOUND_NONE) {
+            value = -(1 << 30); // empty slots are always replaced first
+        } else if (word_key(word) == key) {
+            if (bound != BOUND_EXACT && WORD_GEN(word) == generation &&
+                WORD_DEPTH(word) > depth + 2) {
+                return;
+            }
+
+            // Keep the old move when we have none (e.g. fail-low nodes)
+            if (move == 0)
+                move = WORD_MOVE(word);
+            store_word(slot, pack(hash, depth, score, bound, move));
+            return;
+        } else {
+            int age = (generation - WORD_GEN(word)) & 63;
+            value = WORD_DEPTH(word) - 8 * age;
+        }
+
+        if (value < victim_value) {
+            victim = slot;
+            victim_value = value;
+        }
+    }
+
+    store_word(victim, pack(hash, depth, score, bound, move));
+}
@@ -0,0 +1,60 @@
+#ifndef TT_H
+#define TT_H
+#include "position.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT } BoundType;
+
+/**
+ * A decoded transposition table entry. In the table itself each entry is
+ * packed into a single 64-bit word:
+ *
+ * bits 0-15: best move
+ * bits 16-31: score (int16)
+ * bits 32-39: depth
+ * bits 40-41: bound type
+ * bits 42-47: generation (search counter, used for aging)
+ * bits 48-63: upper 16 bits of the hash XOR a fold of bits 0-47
+ *
+ * Eight entries make up a 64-byte, cache-line aligned bucket. Because the key
+ * check is XORed with the data, a torn write (two threads storing the same
+ * slot at once, or a 64-bit store split in two on 32-bit targets) fails
+ * verification instead of returning a mismatched entry. This makes the table
+ * safe to share between search threads without locks.
+ */
+typedef struct {
+    Move move;
+    int score;
+    int depth;
+    BoundType bound;
+} TTEntry;
+
+#define TT_DEFAULT_MB 16
+
+// Allocates the default size if the table doesn't exist yet.
+bool init_tt();
+void free_tt();
+
+/**
+ * Reallocate the table to use mb megabytes and clear it using the given number
+ * of threads. If the allocation fails the default size is used instead and
+ * false is returned. If even that fails there is no table: probes miss and
+ * stores are dropped until a later resize succeeds.
+ */
+bool resize_tt(size_t mb, int threads);
+void clear_tt(int threads);
+
+// Permille of the table used by the current search, as reported by UCI.
+int tt_hashfull();
+
+// Advance the generation counter, call once per search.
+void tt_new_search();
+
+// Start loading the bucket for hash into cache ahead of a probe.
+void tt_prefetch(uint64_t hash);
+
+// Returns true and fills entry if hash is in the table.
+bool tt_probe(uint64_t hash, TTEntry *entry);
+void tt_store(uint64_t hash, int depth, int score, BoundType bound, Move move);
+#endif // TT_H
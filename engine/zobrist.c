@@ -334,17 +334,8 @@ uint64_t zobrist_piece(uint8_t piece, int sq) {
         ADD_PIECE_COLOR(piece, PIECE_BLACK);                                   \
     } while (0)
 
-uint64_t position_zobrist(Position *p) {
-    uint64_t hash = 0;
-
-    ADD_PIECE(PIECE_PAWN);
-    ADD_PIECE(PIECE_KNIGHT);
-    ADD_PIECE(PIECE_BISHOP);
-    ADD_PIECE(PIECE_ROOK);
-    ADD_PIECE(PIECE_QUEEN);
-    ADD_PIECE(PIECE_KING);
-
-    hash ^= zobrist_castle(p->castling_rights);
+uint64_t zobrist_state(Position *p) {
+    uint64_t hash = zobrist_castle(p->castling_rights);
     int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
     if (p->en_passant != 0) {
         int sq = __builtin_ctzll(p->en_passant);
@@ -369,3 +360,24 @@ uint64_t position_zobrist(Position *p) {
 
     return hash;
 }
+
+uint64_t position_zobrist(Position *p) {
+    uint64_t hash = 0;
+
+    ADD_PIECE(PIECE_PAWN);
+    ADD_PIECE(PIECE_KNIGHT);
+    ADD_PIECE(PIECE_BISHOP);
+    ADD_PIECE(PIECE_ROOK);
+    ADD_PIECE(PIECE_QUEEN);
+    ADD_PIECE(PIECE_KING);
+
+    return hash ^ zobrist_state(p);
+}
+
+uint64_t position_pawn_zobrist(Position *p) {
+    uint64_t hash = 0;
+
+    ADD_PIECE(PIECE_PAWN);
+
+    return hash;
+}
@@ -2,5 +2,24 @@
 #define ZOBRIST_H
 #include "position.h"
 
+extern const uint64_t polyglot_random[781];
+
+// Unchecked zobrist_piece() for hot paths, e.g. incremental updates.
+#define ZOBRIST_PIECE(piece, sq)                                               \
+    (polyglot_random[64 * (2 * PIECE_TYPE(piece) + !PIECE_COLOR(piece)) +      \
+                     (sq)])
+
+uint64_t zobrist_piece(uint8_t piece, int sq);
+
+/**
+ * The part of the key that doesn't depend on piece placement: castling
+ * rights, en passant (only when a capture is possible, as in Polyglot) and
+ * side to move.
+ */
+uint64_t zobrist_state(Position *p);
+
+// Computes the key from scratch; Position::hash holds the same value.
 uint64_t position_zobrist(Position *p);
+// The same for the pawns only; Position::pawn_hash holds the same value.
+uint64_t position_pawn_zobrist(Position *p);
 #endif // ZOBRIST_H
@@ -31,6 +31,7 @@ Game::Game(int width, int height)
         std::cerr << "Failed to initialize transposition table" << std::endl;
         exit(-1);
     }
+    init_endgames();
 
     setup();
     windows.push_back(std::make_unique<Board>(*this));
@@ -1,6 +1,12 @@
 #include "engine.h"
 #include "tinytest.h"
 
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 TEST(test_zobrist_hashing) {
     const char *fens[] = {
         "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
@@ -25,6 +31,410 @@ TEST(test_zobrist_hashing) {
     }
 }
 
+// Walks every line to the given depth, checking the incrementally updated key,
+// psq score and phase against ones computed from scratch.
+static int check_incremental_hash(Position *p, int depth) {
+    if (p->hash != position_zobrist(p) ||
+        p->pawn_hash != position_pawn_zobrist(p) ||
+        p->psq != position_psq(p) || p->phase != position_phase(p))
+        return 1;
+    if (depth == 0)
+        return 0;
+
+    Move moves[256];
+    int count = generate_moves(p, moves);
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        Position copy = *p;
+        execute_move(&copy, moves[i]);
+        failures += check_incremental_hash(&copy, depth - 1);
+    }
+
+    return failures;
+}
+
+TEST(test_incremental_hashing) {
+    const char *fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1"};
+
+    for (int i = 0; i < 4; i++) {
+        Position *p = position_from_fen(fens[i]);
+        ASSERT_EQ(check_incremental_hash(p, 3), 0);
+        free(p);
+    }
+}
+
+TEST(test_pawn_structure) {
+    // a2 and g7 are passed, c5, d4 and d6 all face an enemy pawn
+    Position *p = position_from_fen("4k3/6p1/3p4/2P5/3P4/8/P7/4K3 w - - 0 1");
+    PawnTable *table = calloc(1, sizeof(PawnTable));
+    PawnEntry computed, cached;
+    probe_pawns(NULL, p, &computed);
+    probe_pawns(table, p, &cached);
+    probe_pawns(table, p, &cached);
+
+    ASSERT_EQ(computed.passed[0], 1ULL << 8);
+    ASSERT_EQ(computed.passed[1], 1ULL << 54);
+    ASSERT_EQ(cached.score, computed.score);
+    ASSERT_EQ(cached.attack_span[0], computed.attack_span[0]);
+    free(table);
+    free(p);
+}
+
+TEST(test_lazy_eval) {
+    // White is three queens up; the second position is in check, the third
+    // is mate, neither may stop at the estimate.
+    const char *fens[] = {"4k3/8/8/8/8/8/8/QQQ1K3 w - - 0 1",
+                          "4k3/8/8/8/8/8/8/QQQ1K2r w - - 0 1",
+                          "k7/1Q6/1K6/8/8/8/8/8 b - - 0 1"};
+    for (int i = 0; i < 3; i++) {
+        Position *p = position_from_fen(fens[i]);
+        int side_to_move = p->moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+        ASSERT_EQ(king_attacked(p, side_to_move),
+                  (generate_attacks(p, side_to_move ^ 8) &
+                   p->bitboards[side_to_move | PIECE_KING]) != 0);
+
+        bool lazy;
+        int full = eval_position_lazy(p, NULL, -INF, INF, &lazy);
+        ASSERT_EQ(lazy, false);
+        ASSERT_EQ(full, eval_position(p));
+
+        int estimate = eval_position_lazy(p, NULL, -100, 100, &lazy);
+        ASSERT_EQ(lazy, i == 0);
+        ASSERT_EQ(lazy ? estimate >= 100 + LAZY_MARGIN : estimate == full,
+                  true);
+        free(p);
+    }
+}
+
+TEST(test_checkmate_eval) {
+    // A back rank mate, where the only square the king isn't seen to be
+    // attacked on is behind it on the rook's line, and a check the king
+    // walks out of.
+    Position *p = position_from_fen("R5k1/5ppp/8/8/8/8/8/6K1 b - - 0 1");
+    ASSERT_EQ(eval_position(p), INF - 1);
+    free(p);
+
+    p = position_from_fen("R5k1/5pp1/8/8/8/8/8/6K1 b - - 0 1");
+    ASSERT_EQ(eval_position(p) < INF - 1000, true);
+    free(p);
+}
+
+TEST(test_endgames) {
+    init_endgames();
+    const char *draws[] = {
+        "8/8/3k4/8/8/4K3/8/8 w - - 0 1", "8/8/3k4/8/2N5/4K3/8/8 b - - 0 1",
+        "8/8/3k4/8/8/4K3/8/5b2 w - - 0 1",
+        // The defending king reaches the corner of the rook pawn
+        "k7/8/8/8/8/8/P7/K7 w - - 0 1", "k7/p7/8/8/8/8/8/K7 b - - 0 1",
+        "7k/8/8/8/8/8/7P/7K b - - 0 1"};
+    const char *others[] = {
+        // The king in front of its pawn on the sixth rank wins either way
+        "4k3/8/4K3/4P3/8/8/8/8 w - - 0 1", "4k3/8/4K3/4P3/8/8/8/8 b - - 0 1",
+        // The rook pawn outruns the king
+        "8/8/8/8/8/8/P6k/K7 w - - 0 1", "k7/p6K/8/8/8/8/8/8 b - - 0 1",
+        "8/8/8/8/8/8/7P/k6K w - - 0 1", "8/8/3k4/8/2N5/4K3/8/2n5 w - - 0 1",
+        "8/8/3k4/8/8/4K3/8/4R3 b - - 0 1"};
+    for (int i = 0; i < 6; i++) {
+        Position *p = position_from_fen(draws[i]);
+        ASSERT_EQ(is_known_draw(p), true);
+        free(p);
+    }
+    for (int i = 0; i < 7; i++) {
+        Position *p = position_from_fen(others[i]);
+        ASSERT_EQ(is_known_draw(p), false);
+        free(p);
+    }
+}
+
+TEST(test_eval_cache) {
+    ASSERT_EQ(resize_eval_cache(1), true);
+    uint64_t hash = 0x1234567890ABCDEFULL;
+    int score = 0;
+    ASSERT_EQ(eval_cache_probe(hash, &score), false);
+
+    eval_cache_store(hash, -INF + 1);
+    ASSERT_EQ(eval_cache_probe(hash, &score), true);
+    ASSERT_EQ(score, -INF + 1);
+    // Same slot, different key
+    ASSERT_EQ(eval_cache_probe(hash ^ (1ULL << 40), &score), false);
+    free_eval_cache();
+}
+
+// Walks every line to the given depth, checking the accumulator updated from
+// execute_move()'s dirty pieces against one computed from scratch.
+static int check_nnue_update(Position *p, const Accumulator *acc, int depth) {
+    if (depth == 0)
+        return 0;
+
+    Move moves[256];
+    int count = generate_moves(p, moves);
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        Position copy = *p;
+        execute_move(&copy, moves[i]);
+        Accumulator updated, refreshed;
+        nnue_update(&updated, acc, &copy);
+        nnue_refresh(&refreshed, &copy);
+        if (memcmp(&updated, &refreshed, sizeof(Accumulator)) != 0)
+            failures++;
+        failures += check_nnue_update(&copy, &updated, depth - 1);
+    }
+
+    return failures;
+}
+
+TEST(test_nnue_incremental) {
+    // A network of small random weights in the file format nnue_load() reads
+    char path[] = "/tmp/gce-test-netXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_EQ(fd >= 0, true);
+    FILE *file = fdopen(fd, "wb");
+    fwrite("GCEN", 1, 4, file);
+    uint32_t header[3] = {1, NNUE_KING_BUCKETS, NNUE_HIDDEN};
+    fwrite(header, sizeof(uint32_t), 3, file);
+    size_t count = (size_t)NNUE_INPUTS * NNUE_HIDDEN + 3 * NNUE_HIDDEN + 1;
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        int16_t weight = rand() % 64 - 32;
+        fwrite(&weight, sizeof(weight), 1, file);
+    }
+    fclose(file);
+
+    ASSERT_EQ(nnue_load(path), true);
+    const char *fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "8/8/8/2k5/3Pp3/8/8/4K2Q b - d3 0 1"};
+    for (int i = 0; i < 3; i++) {
+        Position *p = position_from_fen(fens[i]);
+        Accumulator acc;
+        nnue_refresh(&acc, p);
+        ASSERT_EQ(check_nnue_update(p, &acc, 3), 0);
+        free(p);
+    }
+
+    nnue_unload();
+    remove(path);
+}
+
+// Walks every line to the given depth, checking gives_check() against making
+// the move and looking at the attack map.
+static int check_gives_check(Position *p, int depth) {
+    Move moves[256];
+    int count = generate_moves(p, moves);
+    CheckInfo ci;
+    init_check_info(p, &ci);
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        Position copy = *p;
+        execute_move(&copy, moves[i]);
+        int color = copy.moves % 2 == 0 ? PIECE_WHITE : PIECE_BLACK;
+        bool check = generate_attacks(&copy, color ^ 8) &
+                     copy.bitboards[color | PIECE_KING];
+        failures += check != gives_check(p, &ci, moves[i]);
+        if (depth > 1)
+            failures += check_gives_check(&copy, depth - 1);
+    }
+
+    return failures;
+}
+
+TEST(test_tt_entries) {
+    ASSERT_EQ(init_tt(), true);
+    clear_tt(1);
+    uint64_t hash = 0x1234567890ABCDEFULL;
+    Move move = ENCODE_MOVE(12, 28, 0);
+    tt_store(hash, 12, -1234, BOUND_LOWER, move);
+
+    // Every field survives packing, including the score's sign
+    TTEntry entry;
+    ASSERT_EQ(tt_probe(hash, &entry), true);
+    ASSERT_EQ(entry.move, move);
+    ASSERT_EQ(entry.score, -1234);
+    ASSERT_EQ(entry.depth, 12);
+    ASSERT_EQ(entry.bound, BOUND_LOWER);
+
+    // Same bucket, different key check
+    ASSERT_EQ(tt_probe(hash ^ 0x0001000000000000ULL, &entry), false);
+    ASSERT_EQ(tt_probe(hash ^ 0x8000000000000000ULL, &entry), false);
+    free_tt();
+}
+
+TEST(test_tt_without_table) {
+    // What's left after resize_tt() failed even for the default size
+    free_tt();
+    TTEntry entry;
+    tt_prefetch(0x1234567890ABCDEFULL);
+    tt_store(0x1234567890ABCDEFULL, 5, 10, BOUND_EXACT, 0);
+    ASSERT_EQ(tt_probe(0x1234567890ABCDEFULL, &entry), false);
+    ASSERT_EQ(tt_hashfull(), 0);
+}
+
+static int last_pv_length;
+static void record_pv(const SearchInfo *info) {
+    last_pv_length = info->pv_length;
+}
+
+TEST(test_pv_with_warm_tt) {
+    ASSERT_EQ(init_tt(), true);
+    Position *p = position_from_fen(
+        "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3");
+    set_search_info_callback(record_pv);
+    Move move;
+    int depth, eval;
+
+    // The second search starts with the first one's TT, which cuts off most
+    // of the tree right away
+    for (int i = 0; i < 2; i++) {
+        get_best_move_ex(p, -1, 0, 0, 6, -1, -1, false, &move, &depth, &eval);
+        ASSERT_EQ(last_pv_length >= 4, true);
+    }
+
+    set_search_info_callback(NULL);
+    free(p);
+    free_tt();
+}
+
+TEST(test_mate_with_pruning) {
+    // Morphy's mate in 2 starts with a quiet rook sacrifice, the kind of move
+    // futility pruning skips near the leaves
+    ASSERT_EQ(search_params.futility_depth > 0, true);
+    Position *p = position_from_fen("kbK5/pp6/1P6/8/8/8/8/R7 w - - 0 1");
+    Move move;
+    int depth, eval;
+    get_best_move_ex(p, -1, 0, 0, 6, -1, -1, false, &move, &depth, &eval);
+    ASSERT_EQ(move, ENCODE_MOVE(0, 40, 0));
+    ASSERT_EQ(eval, INF - 1 - 3);
+    free(p);
+}
+
+TEST(test_threaded_search) {
+    ASSERT_EQ(set_search_threads(2), true);
+    Position *p = position_from_fen(
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    Move moves[256];
+    int count = generate_moves(p, moves);
+
+    // The helpers are joined before the search returns, so a second search
+    // starts from a clean state
+    for (int i = 0; i < 2; i++) {
+        Move move;
+        int depth, eval;
+        get_best_move_ex(p, -1, 0, 0, 5, -1, -1, false, &move, &depth, &eval);
+        ASSERT_EQ(depth, 5);
+
+        bool legal = false;
+        for (int j = 0; j < count; j++)
+            legal |= moves[j] == move;
+        ASSERT_EQ(legal, true);
+    }
+
+    ASSERT_EQ(set_search_threads(1), true);
+    free(p);
+}
+
+static int ponder_done;
+static bool ponder_finished() {
+    return __atomic_load_n(&ponder_done, __ATOMIC_ACQUIRE);
+}
+
+static void *ponder_search(void *arg) {
+    Move move;
+    int depth, eval;
+    get_best_move_ex(arg, 1000, 0, 0, -1, -1, -1, true, &move, &depth, &eval);
+    __atomic_store_n(&ponder_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+TEST(test_early_ponderhit) {
+    // The ponderhit comes before the search thread has even started, it
+    // must still put the search on the 1 s clock
+    Position *p = position_from_fen(
+        "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3");
+    pthread_t thread;
+    ponder_done = 0;
+    start_ponder();
+    pthread_create(&thread, NULL, ponder_search, p);
+    ponderhit();
+
+    // Give it 3 s, then stop it so a failure doesn't hang
+    struct timespec ts = {0, 1000000};
+    for (int i = 0; i < 3000 && !ponder_finished(); i++)
+        nanosleep(&ts, NULL);
+    bool done = ponder_finished();
+    while (!ponder_finished()) {
+        stop_search();
+        nanosleep(&ts, NULL);
+    }
+    pthread_join(thread, NULL);
+    ASSERT_EQ(done, true);
+    free(p);
+}
+
+TEST(test_node_limit) {
+    Position *p = position_from_fen(
+        "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3");
+    Move move;
+    int depth, eval;
+
+    // A budget too small for the first iteration still finishes it
+    get_best_move_ex(p, -1, 0, 0, -1, -1, 0, false, &move, &depth, &eval);
+    ASSERT_EQ(depth, 1);
+    ASSERT_EQ(move != 0, true);
+
+    get_best_move_ex(p, -1, 0, 0, -1, -1, 20000, false, &move, &depth, &eval);
+    ASSERT_EQ(depth > 1, true);
+    ASSERT_EQ(search_stats.nodes >= 20000, true);
+    ASSERT_EQ(search_stats.nodes < 20000 + 64, true);
+    free(p);
+}
+
+TEST(test_mate_search) {
+    Position *p = position_from_fen(
+        "r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 1");
+    MateResult result;
+    // A budget of 0 nodes is a limit, not "unlimited"
+    ASSERT_EQ(search_mate(p, 3, 0, -1, &result), false);
+    ASSERT_EQ(result.nodes, 0);
+    ASSERT_EQ(search_mate(p, 1, -1, -1, &result), false);
+    ASSERT_EQ(search_mate(p, 3, -1, -1, &result), true);
+    ASSERT_EQ(result.moves, 2);
+    ASSERT_EQ(result.pv_length, 3);
+
+    // The line ends in mate
+    for (int i = 0; i < result.pv_length; i++) {
+        execute_move(p, result.pv[i]);
+    }
+    ASSERT_EQ(position_outcome(p), CHECKMATE);
+    free(p);
+    free_mate_table();
+}
+
+TEST(test_gives_check) {
+    const char *fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "8/8/8/2k5/3Pp3/8/8/4K2Q b - d3 0 1"};
+
+    for (int i = 0; i < 4; i++) {
+        Position *p = position_from_fen(fens[i]);
+        ASSERT_EQ(check_gives_check(p, 3), 0);
+        free(p);
+    }
+}
+
+TEST(test_packed_score) {
+    Score s = S(-35, 120) + S(10, -150) - S(-5, 3);
+    ASSERT_EQ(mg_value(s), -20);
+    ASSERT_EQ(eg_value(s), -33);
+}
+
 int main(void) {
     tinytest_run_all();
     return 0;
@@ -0,0 +1,552 @@
+// Texel tuner for the material values and piece-square tables.
+//
+// The evaluation is linear in these parameters (for a fixed game phase), so
+// every position is reduced once to its list of (piece, square) features plus
+// the contribution of the terms that aren't tuned. Training then only touches
+// those sparse lists and never calls into the engine again.
+#include "engine.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parameters: a middlegame block and an endgame block, each holding the six
+// piece-square tables followed by the six piece values.
+constexpr int TABLE_PARAMS = 6 * 64;
+constexpr int BLOCK = TABLE_PARAMS + 6;
+constexpr int NUM_PARAMS = 2 * BLOCK;
+
+// A feature is type * 64 + square from the piece owner's view, with this bit
+// set for black pieces (which count negatively).
+constexpr uint16_t BLACK_FEATURE = 0x8000;
+
+struct Sample {
+    float result; // 1 for a white win, 0.5 for a draw, 0 for a black win
+    uint8_t phase;
+    uint8_t count;
+    int16_t offset[2]; // middlegame/endgame value of the untuned terms
+    uint64_t start;    // index of the first feature in Dataset::features
+};
+
+struct Dataset {
+    std::vector<Sample> samples;
+    std::vector<uint16_t> features;
+};
+
+struct Options {
+    std::string input;
+    std::string save;
+    std::string out;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int epochs = 300;
+    double lr = 1.0;
+    bool checkGradient = false;
+};
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// Runs fn(thread, begin, end) over [0, count) split into equal ranges.
+template <typename Fn>
+static void parallelFor(int threads, size_t count, Fn fn) {
+    std::vector<std::thread> workers;
+    size_t chunk = (count + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        size_t begin = std::min(count, chunk * t);
+        size_t end = std::min(count, begin + chunk);
+        workers.emplace_back(fn, t, begin, end);
+    }
+    for (auto &worker : workers)
+        worker.join();
+}
+
+// The result is either a PGN result ("1-0", "0-1", "1/2-1/2") or a number in
+// brackets ("[0.5]"), anywhere after the board.
+static bool parseResult(const std::string &line, size_t from, float &result) {
+    size_t bracket = line.find('[', from);
+    if (bracket != std::string::npos) {
+        result = std::strtof(line.c_str() + bracket + 1, nullptr);
+        return true;
+    }
+    if (line.find("1/2-1/2", from) != std::string::npos) {
+        result = 0.5f;
+    } else if (line.find("1-0", from) != std::string::npos) {
+        result = 1.0f;
+    } else if (line.find("0-1", from) != std::string::npos) {
+        result = 0.0f;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// position_from_fen() isn't reentrant, and only the board and side to move
+// matter here anyway.
+static bool parseBoard(const std::string &line, Position &pos, size_t &end) {
+    static const char pieces[] = "pnbrqk";
+    pos = Position{};
+    int rank = 7, file = 0;
+    size_t i = 0;
+    for (; i < line.size() && line[i] != ' '; i++) {
+        char c = line[i];
+        if (c == '/') {
+            rank--;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+        } else {
+            const char *type = std::strchr(pieces, std::tolower(c));
+            if (!type || rank < 0 || file > 7)
+                return false;
+            int color = std::isupper(c) ? PIECE_WHITE : PIECE_BLACK;
+            pos.bitboards[(type - pieces) | color] |= 1ULL << (rank * 8 + file);
+            file++;
+        }
+    }
+
+    if (i + 1 >= line.size())
+        return false;
+    pos.moves = line[i + 1] == 'b';
+    end = i + 2;
+    return pos.bitboards[PIECE_WHITE | PIECE_KING] &&
+           pos.bitboards[PIECE_BLACK | PIECE_KING];
+}
+
+static bool parseSample(const std::string &line, Sample &sample,
+                        std::vector<uint16_t> &features) {
+    Position pos;
+    size_t end;
+    if (!parseBoard(line, pos, end) || !parseResult(line, end, sample.result))
+        return false;
+
+    // Positions in check aren't quiet and get the mate check in the engine
+    int side = pos.moves % 2 ? PIECE_BLACK : PIECE_WHITE;
+    if (generate_attacks(&pos, side ^ 8) & pos.bitboards[side | PIECE_KING])
+        return false;
+
+    Score fixed = eval_positional(&pos);
+    sample.offset[0] = mg_value(fixed);
+    sample.offset[1] = eg_value(fixed);
+    sample.phase = std::min(position_phase(&pos), PHASE_MAX);
+    sample.start = features.size();
+    for (int piece = 0; piece < MAX_PIECE; piece++) {
+        if (PIECE_TYPE(piece) > PIECE_KING)
+            continue;
+        FOREACH_SET_BIT(pos.bitboards[piece], sq) {
+            if (PIECE_COLOR(piece) == PIECE_WHITE)
+                features.push_back(PIECE_TYPE(piece) * 64 + sq);
+            else
+                features.push_back(
+                    (PIECE_TYPE(piece) * 64 + (sq ^ 56)) | BLACK_FEATURE);
+        }
+    }
+    sample.count = features.size() - sample.start;
+    return true;
+}
+
+static void append(Dataset &data, const Dataset &part) {
+    uint64_t base = data.features.size();
+    for (Sample sample : part.samples) {
+        sample.start += base;
+        data.samples.push_back(sample);
+    }
+    data.features.insert(data.features.end(), part.features.begin(),
+                         part.features.end());
+}
+
+// Reads the file in batches of lines that are parsed in parallel.
+static bool loadEpd(const std::string &path, int threads, Dataset &data) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    const size_t batchSize = 1 << 20;
+    std::vector<std::string> lines;
+    std::vector<Dataset> parts(threads);
+    size_t skipped = 0;
+    while (file) {
+        lines.clear();
+        std::string line;
+        while (lines.size() < batchSize && std::getline(file, line))
+            lines.push_back(line);
+
+        parallelFor(threads, lines.size(),
+                    [&](int t, size_t begin, size_t end) {
+                        parts[t] = Dataset{};
+                        Sample sample;
+                        for (size_t i = begin; i < end; i++) {
+                            if (parseSample(lines[i], sample,
+                                            parts[t].features))
+                                parts[t].samples.push_back(sample);
+                        }
+                    });
+
+        size_t before = data.samples.size();
+        for (const auto &part : parts)
+            append(data, part);
+        skipped += lines.size() - (data.samples.size() - before);
+    }
+
+    std::cerr << "Skipped " << skipped
+              << " lines (no result, no king or in check)" << std::endl;
+    return true;
+}
+
+// The binary format is just the two arrays, for the machine that wrote it.
+static const char BINARY_MAGIC[8] = {'G', 'C', 'E', 'T', 'U', 'N', 'E', '1'};
+
+static bool saveBinary(const std::string &path, const Dataset &data) {
+    std::ofstream file(path, std::ios::binary);
+    uint64_t sizes[2] = {data.samples.size(), data.features.size()};
+    file.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    file.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+    file.write(reinterpret_cast<const char *>(data.samples.data()),
+               sizes[0] * sizeof(Sample));
+    file.write(reinterpret_cast<const char *>(data.features.data()),
+               sizes[1] * sizeof(uint16_t));
+    return bool(file);
+}
+
+static bool loadBinary(const std::string &path, Dataset &data) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(BINARY_MAGIC)];
+    uint64_t sizes[2];
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+    if (!file || std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0)
+        return false;
+
+    data.samples.resize(sizes[0]);
+    data.features.resize(sizes[1]);
+    file.read(reinterpret_cast<char *>(data.samples.data()),
+              sizes[0] * sizeof(Sample));
+    file.read(reinterpret_cast<char *>(data.features.data()),
+              sizes[1] * sizeof(uint16_t));
+    return bool(file);
+}
+
+static void initialParams(double *params) {
+    for (int type = 0; type < 6; type++) {
+        for (int sq = 0; sq < 64; sq++) {
+            params[type * 64 + sq] = piece_tables[type][sq];
+            params[BLOCK + type * 64 + sq] = eg_piece_tables[type][sq];
+        }
+        params[TABLE_PARAMS + type] = piece_values[type];
+        params[BLOCK + TABLE_PARAMS + type] = eg_piece_values[type];
+    }
+}
+
+// Tapered evaluation of the sample from white's view, as eval_position().
+static inline double evaluate(const Sample &sample, const uint16_t *features,
+                              const double *params) {
+    double mg = sample.offset[0], eg = sample.offset[1];
+    for (int i = 0; i < sample.count; i++) {
+        int feature = features[i] & ~BLACK_FEATURE;
+        int type = feature / 64;
+        double sign = features[i] & BLACK_FEATURE ? -1.0 : 1.0;
+        mg += sign * (params[feature] + params[TABLE_PARAMS + type]);
+        eg += sign *
+              (params[BLOCK + feature] + params[BLOCK + TABLE_PARAMS + type]);
+    }
+
+    return (mg * sample.phase + eg * (PHASE_MAX - sample.phase)) / PHASE_MAX;
+}
+
+static inline double sigmoid(double k, double eval) {
+    return 1.0 / (1.0 + std::exp(-k * eval / 400.0));
+}
+
+/**
+ * Mean squared error of the predicted results. If gradient is given, also
+ * adds the gradient of the error with respect to every parameter to it.
+ * Each thread sums into its own buffer, which are added up at the end.
+ */
+static double computeLoss(const Dataset &data, const double *params, double k,
+                          int threads, double *gradient) {
+    std::vector<double> losses(threads);
+    std::vector<std::vector<double>> gradients(
+        gradient ? threads : 0, std::vector<double>(NUM_PARAMS));
+    parallelFor(threads, data.samples.size(),
+                [&](int t, size_t begin, size_t end) {
+                    double loss = 0;
+                    double *grad = gradient ? gradients[t].data() : nullptr;
+                    for (size_t i = begin; i < end; i++) {
+                        const Sample &sample = data.samples[i];
+                        const uint16_t *features =
+                            data.features.data() + sample.start;
+                        double eval = evaluate(sample, features, params);
+                        double s = sigmoid(k, eval);
+                        double error = s - sample.result;
+                        loss += error * error;
+                        if (!grad)
+                            continue;
+
+                        double g = 2 * error * s * (1 - s) * k / 400.0;
+                        double mg = g * sample.phase / PHASE_MAX;
+                        double eg = g * (PHASE_MAX - sample.phase) / PHASE_MAX;
+                        for (int j = 0; j < sample.count; j++) {
+                            int feature = features[j] & ~BLACK_FEATURE;
+                            int type = feature / 64;
+                            double sign =
+                                features[j] & BLACK_FEATURE ? -1.0 : 1.0;
+                            grad[feature] += sign * mg;
+                            grad[TABLE_PARAMS + type] += sign * mg;
+                            grad[BLOCK + feature] += sign * eg;
+                            grad[BLOCK + TABLE_PARAMS + type] += sign * eg;
+                        }
+                    }
+                    losses[t] = loss;
+                });
+
+    double loss = 0;
+    double count = data.samples.size();
+    for (int t = 0; t < threads; t++) {
+        loss += losses[t];
+        if (!gradient)
+            continue;
+        for (int i = 0; i < NUM_PARAMS; i++)
+            gradient[i] += gradients[t][i] / count;
+    }
+
+    return loss / count;
+}
+
+// The scaling constant of the sigmoid that best fits the current evaluation,
+// by golden section search.
+static double findK(const Dataset &data, const double *params, int threads) {
+    const double ratio = (std::sqrt(5.0) - 1) / 2;
+    double low = 0.1, high = 4.0;
+    for (int i = 0; i < 30; i++) {
+        double a = high - ratio * (high - low);
+        double b = low + ratio * (high - low);
+        if (computeLoss(data, params, a, threads, nullptr) <
+            computeLoss(data, params, b, threads, nullptr))
+            high = b;
+        else
+            low = a;
+    }
+
+    return (low + high) / 2;
+}
+
+// Adam on the full dataset. The king has no material value.
+static void train(const Dataset &data, double *params, double k,
+                  const Options &options) {
+    // The gradients are small (the loss is at most 1 and moves by k / 400
+    // per centipawn), so epsilon has to be smaller still
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-12;
+    std::vector<double> m(NUM_PARAMS), v(NUM_PARAMS), gradient(NUM_PARAMS);
+    auto start = std::chrono::steady_clock::now();
+    for (int epoch = 1; epoch <= options.epochs; epoch++) {
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        double loss =
+            computeLoss(data, params, k, options.threads, gradient.data());
+
+        double correction1 = 1 - std::pow(beta1, epoch);
+        double correction2 = 1 - std::pow(beta2, epoch);
+        for (int i = 0; i < NUM_PARAMS; i++) {
+            double g = gradient[i];
+            m[i] = beta1 * m[i] + (1 - beta1) * g;
+            v[i] = beta2 * v[i] + (1 - beta2) * g * g;
+            params[i] -= options.lr * (m[i] / correction1) /
+                         (std::sqrt(v[i] / correction2) + epsilon);
+        }
+        params[TABLE_PARAMS + PIECE_KING] = 0;
+        params[BLOCK + TABLE_PARAMS + PIECE_KING] = 0;
+
+        if (epoch % 10 == 0 || epoch == options.epochs) {
+            std::fprintf(stderr, "Epoch %d: loss %.7f (%.1f s)\n", epoch, loss,
+                         elapsed(start));
+        }
+    }
+}
+
+/**
+ * Compares the gradient from computeLoss() with central differences of the
+ * loss for the parameters it is steepest in, then takes one small step
+ * against it, which must lower the loss. Returns whether both held.
+ */
+static bool checkGradient(const Dataset &data, const double *params, double k,
+                          int threads) {
+    std::vector<double> gradient(NUM_PARAMS), shifted(params,
+                                                      params + NUM_PARAMS);
+    double loss = computeLoss(data, params, k, threads, gradient.data());
+
+    std::vector<int> steepest(NUM_PARAMS);
+    for (int i = 0; i < NUM_PARAMS; i++)
+        steepest[i] = i;
+    std::sort(steepest.begin(), steepest.end(), [&](int a, int b) {
+        return std::abs(gradient[a]) > std::abs(gradient[b]);
+    });
+
+    const double h = 0.5;
+    bool ok = true;
+    for (int n = 0; n < 16; n++) {
+        int i = steepest[n];
+        shifted[i] = params[i] + h;
+        double above = computeLoss(data, shifted.data(), k, threads, nullptr);
+        shifted[i] = params[i] - h;
+        double below = computeLoss(data, shifted.data(), k, threads, nullptr);
+        shifted[i] = params[i];
+
+        double numeric = (above - below) / (2 * h);
+        double error = std::abs(numeric - gradient[i]) /
+                       std::max(std::abs(numeric), 1e-12);
+        std::fprintf(stderr, "param %4d: gradient %+.6e numeric %+.6e%s\n",
+                     i, gradient[i], numeric, error < 1e-3 ? "" : "  FAIL");
+        ok &= error < 1e-3;
+    }
+
+    // A step that moves no parameter by more than a centipawn
+    double step = 1.0 / std::abs(gradient[steepest[0]]);
+    for (int i = 0; i < NUM_PARAMS; i++)
+        shifted[i] = params[i] - step * gradient[i];
+    double after = computeLoss(data, shifted.data(), k, threads, nullptr);
+    std::fprintf(stderr, "one step: loss %.9f -> %.9f%s\n", loss, after,
+                 after < loss ? "" : "  FAIL");
+    return ok && after < loss;
+}
+
+static const char *PIECE_NAMES[6] = {"pawn", "knight", "bishop",
+                                     "rook", "queen",  "king"};
+static const char *PIECE_ENUMS[6] = {"PIECE_PAWN", "PIECE_KNIGHT",
+                                     "PIECE_BISHOP", "PIECE_ROOK",
+                                     "PIECE_QUEEN",  "PIECE_KING"};
+
+static void printValues(std::FILE *out, const char *name,
+                        const double *values) {
+    std::fprintf(out, "const int %s[6] = {", name);
+    for (int type = 0; type < 6; type++) {
+        const char *separator = type == 0   ? "\n    "
+                                : type == 3 ? ",\n    "
+                                            : ", ";
+        std::fprintf(out, "%s[%s] = %ld", separator, PIECE_ENUMS[type],
+                     std::lround(values[type]));
+    }
+    std::fprintf(out, "};\n\n");
+}
+
+static void printTables(std::FILE *out, const char *name,
+                        const double *tables) {
+    std::fprintf(out, "const int %s[6][64] = {\n", name);
+    for (int type = 0; type < 6; type++) {
+        std::fprintf(out, "    // %s\n    {", PIECE_NAMES[type]);
+        for (int sq = 0; sq < 64; sq++) {
+            if (sq % 8 == 0)
+                std::fprintf(out, "%s", sq ? "\n     " : "");
+            std::fprintf(out, "%5ld%s", std::lround(tables[type * 64 + sq]),
+                         sq < 63 ? "," : "");
+        }
+        std::fprintf(out, "}%s\n", type < 5 ? ",\n" : "};");
+    }
+}
+
+// Writes the tuned parameters as a drop-in replacement for the tables in
+// engine/eval.c.
+static void printParams(std::FILE *out, const double *params) {
+    printValues(out, "piece_values", params + TABLE_PARAMS);
+    printValues(out, "eg_piece_values", params + BLOCK + TABLE_PARAMS);
+    printTables(out, "piece_tables", params);
+    std::fprintf(out, "\n");
+    printTables(out, "eg_piece_tables", params + BLOCK);
+}
+
+static void usage() {
+    std::cerr
+        << "Usage: gce-tune <positions.epd|positions.bin> [--threads N]\n"
+           "                [--epochs N] [--lr X] [--save file.bin] [--out "
+           "file]\n                [--check-gradient]\n\n"
+           "Each EPD line holds a FEN and the game result, either as 1-0, "
+           "0-1 or 1/2-1/2\nor as a number in brackets, e.g. [0.5]. --save "
+           "writes the parsed positions in\na binary format that loads much "
+           "faster. The tables are written to --out or\nstdout. "
+           "--check-gradient compares the gradient with the loss instead "
+           "of\ntraining.\n";
+}
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue) {
+            options.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--epochs" && hasValue) {
+            options.epochs = std::atoi(argv[++i]);
+        } else if (arg == "--lr" && hasValue) {
+            options.lr = std::atof(argv[++i]);
+        } else if (arg == "--save" && hasValue) {
+            options.save = argv[++i];
+        } else if (arg == "--out" && hasValue) {
+            options.out = argv[++i];
+        } else if (arg == "--check-gradient") {
+            options.checkGradient = true;
+        } else if (arg.starts_with("--") || !options.input.empty()) {
+            return false;
+        } else {
+            options.input = arg;
+        }
+    }
+
+    return !options.input.empty();
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Dataset data;
+    bool binary = options.input.ends_with(".bin");
+    if (!(binary ? loadBinary(options.input, data)
+                 : loadEpd(options.input, options.threads, data))) {
+        std::cerr << "Failed to read " << options.input << std::endl;
+        return 1;
+    }
+    if (data.samples.empty()) {
+        std::cerr << "No positions in " << options.input << std::endl;
+        return 1;
+    }
+    std::fprintf(stderr, "Loaded %zu positions in %.1f s\n",
+                 data.samples.size(), elapsed(start));
+
+    if (!options.save.empty() && !saveBinary(options.save, data)) {
+        std::cerr << "Failed to write " << options.save << std::endl;
+    }
+
+    std::vector<double> params(NUM_PARAMS);
+    initialParams(params.data());
+    double k = findK(data, params.data(), options.threads);
+    std::fprintf(stderr, "K = %.4f, initial loss %.7f\n", k,
+                 computeLoss(data, params.data(), k, options.threads,
+                             nullptr));
+    if (options.checkGradient)
+        return checkGradient(data, params.data(), k, options.threads) ? 0 : 1;
+
+    train(data, params.data(), k, options);
+
+    std::FILE *out = options.out.empty() ? stdout
+                                         : std::fopen(options.out.c_str(), "w");
+    if (!out) {
+        std::cerr << "Failed to open " << options.out << std::endl;
+        out = stdout;
+    }
+    printParams(out, params.data());
+    if (out != stdout)
+        std::fclose(out);
+    return 0;
+}
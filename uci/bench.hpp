@@ -0,0 +1,18 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+#include <cstddef>
+#include <cstdint>
+
+#define BENCH_DEFAULT_DEPTH 7
+
+/**
+ * Search a fixed set of positions to the given depth with a cleared hash table
+ * and print the total node count and NPS. With a single thread the node count
+ * is deterministic, so it doubles as a signature of the search: any change to
+ * it means the search behaves differently.
+ *
+ * The thread count and hash size are changed for the benchmark; callers
+ * should restore their own settings afterwards. Returns the total nodes.
+ */
+uint64_t runBench(int depth, int threads, size_t hashMb);
+#endif // BENCH_HPP
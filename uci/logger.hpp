@@ -2,6 +2,7 @@
 #define LOGGING_HPP
 #include <fstream>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
 class Logger {
@@ -16,6 +17,7 @@ class Logger {
     }
 
     template <typename... Args> void log(Args &&...args) {
+        std::lock_guard<std::mutex> lock(mutex);
         if (!file.is_open())
             return;
         file << timestamp();
@@ -26,6 +28,7 @@ class Logger {
 
   private:
     std::ofstream file;
+    std::mutex mutex;
 
     std::string timestamp() {
         auto t = std::time(nullptr);
@@ -1,10 +1,15 @@
+#include "bench.hpp"
 #include "engine.h"
 #include "logger.hpp"
+#include <atomic>
+#include <chrono>
 #include <cstdarg>
 #include <cstdlib>
 #include <deque>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #ifdef _WIN32
@@ -13,16 +18,28 @@ static auto logger = Logger("gce-uci.log");
 static auto logger = Logger(std::string(getenv("HOME")) + "/gce-uci.log");
 #endif
 
+// The search runs on its own thread so the main loop can keep reading
+// commands (stop, ponderhit, isready) while it searches.
+static std::thread searchThread;
+static std::atomic<bool> searchDone{true};
+static std::mutex outputMutex;
+
+// The Hash option, restored after a bench.
+static size_t hashSize = TT_DEFAULT_MB;
+
 void flush() { std::cout << std::flush; }
 void sendMessage(const char *fmt, ...) {
-    char buf[1024];
+    char buf[2048];
 
     va_list args;
     va_start(args, fmt);
     vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
 
-    std::cout << buf << "\n";
+    // Messages come from both threads, and bestmove must not wait in the
+    // buffer until the next command arrives.
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << buf << std::endl;
     logger.log("Sent message: ", buf);
 }
 
@@ -125,20 +142,183 @@ Position *parsePosition(std::string input) {
     return position;
 }
 
+// Stops the running search, if any, and waits for it to print bestmove.
+void stopSearch() {
+    if (!searchThread.joinable())
+        return;
+
+    // A stop sent before the search thread reached the engine is ignored, so
+    // keep asking until it's done.
+    while (!searchDone) {
+        stop_search();
+        stop_mate_search();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    searchThread.join();
+}
+
+// The last reported PV, used to pick the move to ponder on.
+static Move lastPv[2];
+static int lastPvLength = 0;
+
+// Set by `debug on`, prints the search statistics before each bestmove.
+static std::atomic<bool> debugMode{false};
+static uint64_t iterationNodes[2];
+
+void sendInfo(const SearchInfo *info) {
+    std::string score = info->mate != 0
+                            ? "mate " + std::to_string(info->mate)
+                            : "cp " + std::to_string(info->score);
+    std::string pv;
+    for (int i = 0; i < info->pv_length; i++) {
+        pv += ' ';
+        pv += formatMove(info->pv[i]);
+    }
+
+    // The ponder move and branching factor only follow the best line
+    if (info->multipv == 1) {
+        iterationNodes[0] = info->depth > 1 ? iterationNodes[1] : 0;
+        iterationNodes[1] = info->nodes;
+
+        lastPvLength = info->pv_length < 2 ? info->pv_length : 2;
+        for (int i = 0; i < lastPvLength; i++) {
+            lastPv[i] = info->pv[i];
+        }
+    }
+
+    sendMessage("info depth %d seldepth %d multipv %d score %s nodes %llu nps "
+                "%llu time %d hashfull %d pv%s",
+                info->depth, info->seldepth, info->multipv, score.c_str(),
+                (unsigned long long)info->nodes, (unsigned long long)info->nps,
+                info->time_ms, info->hashfull, pv.c_str());
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0;
+}
+
+void sendStats() {
+    const SearchStats &stats = search_stats;
+#ifdef GCE_SEARCH_STATS
+    sendMessage("info string nodes %llu qnodes %llu (%.1f%%)",
+                (unsigned long long)stats.nodes,
+                (unsigned long long)stats.qnodes,
+                percent(stats.qnodes, stats.nodes));
+    sendMessage("info string tt probes %llu hits %.1f%% cutoffs %.1f%%",
+                (unsigned long long)stats.tt_probes,
+                percent(stats.tt_hits, stats.tt_probes),
+                percent(stats.tt_cutoffs, stats.tt_probes));
+    sendMessage("info string beta cutoffs %llu first move %.1f%%",
+                (unsigned long long)stats.beta_cutoffs,
+                percent(stats.first_move_cutoffs, stats.beta_cutoffs));
+    sendMessage("info string pruned futility %llu rfp %llu razor %llu "
+                "endgame %llu",
+                (unsigned long long)stats.futility_prunes,
+                (unsigned long long)stats.rfp_prunes,
+                (unsigned long long)stats.razor_prunes,
+                (unsigned long long)stats.endgame_draws);
+    sendMessage("info string eval cache probes %llu hits %.1f%% lazy %.1f%%",
+                (unsigned long long)stats.eval_probes,
+                percent(stats.eval_hits, stats.eval_probes),
+                percent(stats.lazy_evals, stats.eval_probes));
+    sendMessage("info string pawn table probes %llu hits %.1f%%",
+                (unsigned long long)stats.pawn_probes,
+                percent(stats.pawn_hits, stats.pawn_probes));
+#else
+    sendMessage("info string nodes %llu, other statistics are disabled in "
+                "this build",
+                (unsigned long long)stats.nodes);
+#endif
+    if (iterationNodes[0] > 0) {
+        sendMessage("info string branching factor %.2f",
+                    (double)iterationNodes[1] / iterationNodes[0]);
+    }
+}
+
+// The expected reply to move according to the PV, falling back to the TT, or
+// an empty string.
+std::string ponderMove(Position position, Move move) {
+    if (lastPvLength == 2 && lastPv[0] == move)
+        return formatMove(lastPv[1]);
+
+    execute_move(&position, move);
+    TTEntry entry;
+    if (!tt_probe(position.hash, &entry) || entry.move == 0)
+        return "";
+
+    Move moves[256];
+    int count = generate_moves(&position, moves);
+    for (int i = 0; i < count; i++) {
+        if (moves[i] == entry.move)
+            return formatMove(entry.move);
+    }
+
+    return "";
+}
+
+// go mate: runs the proof-number solver instead of the regular search and
+// reports the mating line, or bestmove 0000 if there is none within the
+// limits.
+void parseGoMate(Position *root, int moves, int64_t nodes, float move_time) {
+    MateResult result;
+    if (!search_mate(root, moves, nodes, move_time, &result)) {
+        sendMessage("info string no mate in %d found nodes %llu time %d", moves,
+                    (unsigned long long)result.nodes, result.time_ms);
+        sendMessage("bestmove 0000");
+        return;
+    }
+
+    std::string pv;
+    for (int i = 0; i < result.pv_length; i++) {
+        pv += ' ';
+        pv += formatMove(result.pv[i]);
+    }
+
+    uint64_t nps =
+        result.time_ms > 0 ? result.nodes * 1000 / result.time_ms : 0;
+    sendMessage("info depth %d score mate %d nodes %llu nps %llu time %d pv%s",
+                result.moves * 2 - 1, result.moves,
+                (unsigned long long)result.nodes, (unsigned long long)nps,
+                result.time_ms, pv.c_str());
+    if (result.pv_length > 1) {
+        sendMessage("bestmove %s ponder %s", formatMove(result.pv[0]).c_str(),
+                    formatMove(result.pv[1]).c_str());
+    } else {
+        sendMessage("bestmove %s", formatMove(result.pv[0]).c_str());
+    }
+}
+
 void parseGo(std::string input, Position *position) {
     std::vector<std::string> argv = splitStr(input);
     auto args = std::deque(argv.begin(), argv.end());
     args.pop_front();
 
-    float time_available = 0;
+    float time_available = -1;
     float increment = 0;
     int moves_to_go = 0;
     int depth = -1;
     float move_time = -1;
+    int64_t nodes = -1;
+    int mate = 0;
+    bool infinite = false;
+    bool ponder = false;
 
     while (!args.empty() && !args.front().empty()) {
         std::string arg = args.front();
         args.pop_front();
+
+        // flags without a value
+        if (arg == "infinite") {
+            infinite = true;
+            continue;
+        } else if (arg == "ponder") {
+            ponder = true;
+            continue;
+        }
+
+        if (args.empty())
+            break;
         std::string value = args.front();
         args.pop_front();
 
@@ -153,27 +333,133 @@ void parseGo(std::string input, Position *position) {
             move_time = std::stof(value);
         } else if (arg == "depth") {
             depth = std::stoi(value);
+        } else if (arg == "nodes") {
+            nodes = std::stoll(value);
+        } else if (arg == "mate") {
+            mate = std::stoi(value);
         }
     }
 
-    if (time_available == 0 && moves_to_go == 0 && depth == -1 &&
-        move_time == -1) {
+    if (mate > 0) {
+        stopSearch();
+        searchDone = false;
+        searchThread = std::thread([=, root = *position]() mutable {
+            parseGoMate(&root, mate, nodes, move_time);
+            searchDone = true;
+        });
+        return;
+    }
+
+    if (infinite) {
+        time_available = -1;
+    } else if (time_available == -1 && depth == -1 && move_time == -1 &&
+               nodes == -1) {
         logger.log(
             "Got `go` command with no valid args, falling back to depth 7.");
 
         depth = 7;
     }
 
-    int result_depth, result_eval;
-    Move result_move;
+    stopSearch();
+    if (ponder)
+        start_ponder();
+    searchDone = false;
+    searchThread = std::thread([=, root = *position]() mutable {
+        int result_depth, result_eval;
+        Move result_move;
+
+        lastPvLength = 0;
+        iterationNodes[0] = 0;
+        get_best_move_ex(&root, time_available, increment, moves_to_go, depth,
+                         move_time, nodes, ponder, &result_move,
+                         &result_depth, &result_eval);
+
+        if (debugMode)
+            sendStats();
+        // No legal move, or no memory to search with
+        if (!result_move) {
+            sendMessage("bestmove 0000");
+            searchDone = true;
+            return;
+        }
+        std::string reply = ponderMove(root, result_move);
+        if (reply.empty()) {
+            sendMessage("bestmove %s", formatMove(result_move).c_str());
+        } else {
+            sendMessage("bestmove %s ponder %s", formatMove(result_move).c_str(),
+                        reply.c_str());
+        }
+        searchDone = true;
+    });
+}
 
-    get_best_move_ex(position, time_available, increment, moves_to_go, depth,
-                     move_time, &result_move, &result_depth, &result_eval);
+void parseSetOption(const std::string &input) {
+    // setoption name <id> [value <x>]
+    std::vector<std::string> argv = splitStr(input);
+    std::string name, value;
+    std::string *current = nullptr;
+    for (size_t i = 1; i < argv.size(); i++) {
+        if (argv[i] == "name") {
+            current = &name;
+        } else if (argv[i] == "value") {
+            current = &value;
+        } else if (current) {
+            if (!current->empty())
+                *current += " ";
+            *current += argv[i];
+        }
+    }
 
-    sendMessage("info depth %i score cp %d", result_depth, result_eval);
-    sendMessage("bestmove %s", formatMove(result_move).c_str());
+    if (name == "Threads") {
+        if (!set_search_threads(std::stoi(value))) {
+            logger.log("Failed to allocate search threads");
+        }
+    } else if (name == "Hash") {
+        hashSize = std::stoul(value);
+        if (!resize_tt(hashSize, get_search_threads())) {
+            logger.log("Failed to allocate ", value.c_str(),
+                       " MB for transposition table");
+            hashSize = TT_DEFAULT_MB;
+        }
+    } else if (name == "Eval Cache") {
+        if (!resize_eval_cache(std::stoul(value))) {
+            logger.log("Failed to allocate ", value.c_str(),
+                       " MB for eval cache");
+        }
+    } else if (name == "EvalFile") {
+        if (value.empty() || value == "<empty>") {
+            nnue_unload();
+        } else if (!nnue_load(value.c_str())) {
+            logger.log("Failed to load network ", value.c_str());
+        }
+        // Cached scores came from the previous evaluator
+        clear_eval_cache();
+    } else if (name == "Clear Hash") {
+        clear_tt(get_search_threads());
+    } else if (name == "MultiPV") {
+        set_multi_pv(std::stoi(value));
+    } else if (name == "Ponder") {
+        // only tells us the GUI may send `go ponder`, nothing to configure
+    } else {
+        logger.log("Unknown option: ", name.c_str());
+    }
 }
-int main() {
+
+// bench [depth] [threads] [hashMB]
+void parseBench(const std::vector<std::string> &args) {
+    int depth = args.size() > 1 ? std::stoi(args[1]) : BENCH_DEFAULT_DEPTH;
+    int threads = args.size() > 2 ? std::stoi(args[2]) : 1;
+    size_t hash = args.size() > 3 ? std::stoul(args[3]) : TT_DEFAULT_MB;
+
+    int oldThreads = get_search_threads();
+    set_search_info_callback(nullptr);
+    runBench(depth, threads, hash);
+    set_search_info_callback(sendInfo);
+    set_search_threads(oldThreads);
+    resize_tt(hashSize, oldThreads);
+}
+
+int main(int argc, char **argv) {
     logger.log("Started");
     std::string input;
     Position *position = nullptr;
@@ -182,16 +468,38 @@ int main() {
         logger.log("Failed to allocate memory for transposition table");
         exit(-1);
     }
+    // Tens of milliseconds, better spent now than on the first move
+    init_endgames();
+    set_search_info_callback(sendInfo);
+
+    // `gce-uci bench ...` runs the benchmark and exits, e.g. for CI
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        parseBench(std::vector<std::string>(argv + 1, argv + argc));
+        free_tt();
+        free_eval_cache();
+        return 0;
+    }
 
     while (std::getline(std::cin, input)) {
         logger.log("Got command: ", input.c_str());
         if (input == "quit") {
+            stopSearch();
             goto cleanup;
         }
 
         if (input == "uci") {
             sendMessage("id name Gideon's Chess Engine");
             sendMessage("id author Gideon Grinberg");
+            sendMessage("option name Hash type spin default %d min 1 max 65536",
+                        TT_DEFAULT_MB);
+            sendMessage("option name Clear Hash type button");
+            sendMessage(
+                "option name Eval Cache type spin default %d min 0 max 4096",
+                EVAL_CACHE_DEFAULT_MB);
+            sendMessage("option name EvalFile type string default <empty>");
+            sendMessage("option name Threads type spin default 1 min 1 max 256");
+            sendMessage("option name Ponder type check default false");
+            sendMessage("option name MultiPV type spin default 1 min 1 max 256");
             sendMessage("uciok");
             flush();
         }
@@ -200,12 +508,40 @@ int main() {
             sendMessage("readyok");
             flush();
         }
+        if (input == "stop") {
+            stopSearch();
+        }
+
+        if (input.starts_with("debug")) {
+            debugMode = input == "debug on";
+        }
+
+        if (input == "ponderhit") {
+            ponderhit();
+        }
+
+        if (input == "ucinewgame") {
+            stopSearch();
+            clear_tt(get_search_threads());
+            clear_eval_cache();
+        }
+
+        if (input.starts_with("setoption")) {
+            stopSearch();
+            parseSetOption(input);
+        }
+
         if (input.starts_with("position")) {
             position = parsePosition(input);
             if (!position)
                 return -1;
         }
 
+        if (input.starts_with("bench")) {
+            stopSearch();
+            parseBench(splitStr(input));
+        }
+
         if (input.starts_with("go")) {
             parseGo(input, position);
         }
@@ -214,6 +550,9 @@ int main() {
 cleanup:
     logger.log("Goodbye");
     free_tt();
+    free_eval_cache();
+    free_mate_table();
+    nnue_unload();
     logger.log("Freed transposition table.");
     exit(0);
 }
\ No newline at end of file